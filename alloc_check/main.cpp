@@ -0,0 +1,180 @@
+// Checks that a control loop in the steady state doesn't allocate memory. The ODrive is
+// connected via UART to a pseudo terminal, where another thread answers the requests with
+// ODriveSim (see odrive_sim.h), like the uart_emulator. operator new counts the allocations of
+// the main thread only, so the simulator can allocate freely. After a few frames to warm up,
+// every frame of the loop gets and sets values in a pipeline, calls a function, does a
+// synchronized write and a single get. Returns 1 if any of that allocated.
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <termios.h>
+#include <sys/select.h>
+#include <new>
+#include <string>
+#include <thread>
+#include <atomic>
+#include "../common/odrive/ODrive.h"
+#include "../common/odrive/odrive_sim.h"
+#include "../common/time_helper.h"
+
+static const int warmup_frames = 100;
+static const int frames = 1000;
+
+static thread_local bool count_allocations = false;
+static long allocations = 0;
+
+void* operator new(size_t size)
+{
+	if (count_allocations)
+		allocations++;
+	void* p = malloc(size ? size : 1);
+	if (!p)
+		throw std::bad_alloc();
+	return p;
+}
+void operator delete(void* p) noexcept
+{
+	free(p);
+}
+void operator delete(void* p, size_t) noexcept
+{
+	free(p);
+}
+
+// Like in the uart_emulator, but the master side stays blocking.
+static bool open_pty(int* master, int* slave, std::string* slave_path)
+{
+	*master = posix_openpt(O_RDWR | O_NOCTTY);
+	if (*master < 0 || grantpt(*master) != 0 || unlockpt(*master) != 0)
+	{
+		printf("Failed to create a pseudo terminal: %s\n", strerror(errno));
+		return false;
+	}
+	*slave_path = ptsname(*master);
+	*slave = open(slave_path->c_str(), O_RDWR | O_NOCTTY);
+	if (*slave < 0)
+	{
+		printf("Failed to open %s: %s\n", slave_path->c_str(), strerror(errno));
+		return false;
+	}
+	termios options;
+	tcgetattr(*slave, &options);
+	cfmakeraw(&options);
+	tcsetattr(*slave, TCSANOW, &options);
+	return true;
+}
+
+// Answers the fibre packets that arrive on master without throttling, until stop is set.
+static void answer_requests(int master, ODriveSim* sim, const std::atomic<bool>* stop)
+{
+	u8 rx_stream[4*max_stream_packet_size];
+	int rx_length = 0;
+	while (!*stop)
+	{
+		fd_set read_set;
+		FD_ZERO(&read_set);
+		FD_SET(master, &read_set);
+		timeval tv = {0, 1000};
+		if (select(master+1, &read_set, nullptr, nullptr, &tv) > 0)
+		{
+			int n = (int)read(master, rx_stream+rx_length, sizeof(rx_stream)-rx_length);
+			if (n > 0)
+				rx_length += n;
+		}
+
+		u64_micros now = time_micros_64();
+		u8 packet[max_packet_size];
+		int packet_length, consumed;
+		bool skipped;
+		for (;;)
+		{
+			bool found = ODrive::find_stream_packet(rx_stream, rx_length, packet, max_packet_size, &packet_length, &consumed, &skipped);
+			memmove(rx_stream, rx_stream+consumed, rx_length-consumed);
+			rx_length -= consumed;
+			if (!found)
+				break;
+			sim->handle_packet(packet, packet_length, now);
+		}
+
+		u8 response[max_packet_size];
+		int response_length;
+		while (sim->receive_response(response, max_packet_size, &response_length, now))
+		{
+			serial_buffer response_packet;
+			for (int i = 0; i < response_length; i++)
+				response_packet.push_back(response[i]);
+			stream_buffer stream = ODrive::packet_to_stream(response_packet);
+			if (write(master, stream.data(), stream.size()) != (ssize_t)stream.size())
+				printf("write to the pseudo terminal failed: %s\n", strerror(errno));
+		}
+	}
+}
+
+int main()
+{
+	time_init();
+
+	int master, slave;
+	std::string slave_path;
+	if (!open_pty(&master, &slave, &slave_path))
+		return EXIT_FAILURE;
+
+	ODriveSim sim;
+	sim.latency = 0;
+	std::atomic<bool> stop{false};
+	std::thread sim_thread(answer_requests, master, &sim, &stop);
+
+	ODrive odrive;
+	if (!odrive.connect_uart(slave_path.c_str(), 921600, false))
+	{
+		stop = true;
+		sim_thread.join();
+		return EXIT_FAILURE;
+	}
+	Endpoint& axis = odrive.root("axis0");
+	EndpointHandle pos_estimate = axis("encoder")("pos_estimate").handle();
+	EndpointHandle vel_estimate = axis("encoder")("vel_estimate").handle();
+	EndpointHandle shadow_count = axis("encoder")("shadow_count").handle();
+	EndpointHandle motor_error = axis("motor")("error").handle();
+	EndpointHandle watchdog_feed = axis("watchdog_feed").handle();
+	EndpointHandle input_pos[2] = {axis("controller")("input_pos").handle(),
+		odrive.root("axis1")("controller")("input_pos").handle()};
+	EndpointHandle vbus_voltage = odrive.root("vbus_voltage").handle();
+
+	float pos = 0, vel = 0, voltage = 0;
+	s32 count = 0;
+	u64 error = 0;
+	for (int frame = 0; frame < warmup_frames+frames && !odrive.communication_error; frame++)
+	{
+		if (frame == warmup_frames)
+			count_allocations = true;
+		odrive.pipeline_begin();
+		pos_estimate.get(pos);
+		vel_estimate.get(vel);
+		shadow_count.get(count);
+		motor_error.get(error);
+		watchdog_feed.call();
+		odrive.pipeline_end();
+
+		float setpoints[2] = {.001f*frame, -.001f*frame};
+		WriteTiming timing;
+		odrive.set_synchronized(input_pos, setpoints, 2, &timing);
+		vbus_voltage.get(voltage);
+	}
+	count_allocations = false;
+	bool ok = !odrive.communication_error;
+
+	odrive.close();
+	stop = true;
+	sim_thread.join();
+	close(slave);
+	close(master);
+
+	printf("%ld allocations in %d frames\n", allocations, frames);
+	if (!ok)
+		printf("communication error\n");
+	return ok && allocations == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
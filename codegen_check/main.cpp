@@ -0,0 +1,61 @@
+// Compiles a header that endpoint_codegen generated from the simulated ODrive (see CMakeLists.txt)
+// and uses it: every TypedEndpoint type is instantiated completely, so set() and get() have to
+// compile for all of them, and values of each type are written and read back via the simulator.
+// Returns 1 if a value doesn't match or the json crc isn't the one of the header.
+#include <stdlib.h>
+#include <stdio.h>
+#include "../common/odrive/odrive_sim.h"
+#include "sim_endpoints.h"
+
+template struct TypedEndpoint<bool, 0, 0>;
+template struct TypedEndpoint<u8, 0, 0>;
+template struct TypedEndpoint<s8, 0, 0>;
+template struct TypedEndpoint<u16, 0, 0>;
+template struct TypedEndpoint<s16, 0, 0>;
+template struct TypedEndpoint<u32, 0, 0>;
+template struct TypedEndpoint<s32, 0, 0>;
+template struct TypedEndpoint<u64, 0, 0>;
+template struct TypedEndpoint<s64, 0, 0>;
+template struct TypedEndpoint<float, 0, 0>;
+
+static int failures = 0;
+
+template<typename T, int ID, u32 JSON_CRC>
+static void check(ODrive& odrive, const TypedEndpoint<T, ID, JSON_CRC>& endpoint, T value)
+{
+	endpoint.set(odrive, value);
+	T received = endpoint.get2(odrive);
+	if (received == value)
+		return;
+	failures++;
+	printf("%s should be %g, but is %g\n", endpoint.path, (double)value, (double)received);
+}
+
+int main()
+{
+	time_init();
+	ODriveSim sim;
+	ODrive odrive;
+	if (!odrive.connect_sim(&sim))
+		return EXIT_FAILURE;
+	if (odrive.get_json_crc() != ep::json_crc)
+	{
+		printf("the json crc is 0x%08x, but the header is for 0x%08x\n", odrive.get_json_crc(), ep::json_crc);
+		return EXIT_FAILURE;
+	}
+
+	check(odrive, ep::axis0::error, (u32)0x80000001);
+	check(odrive, ep::axis0::motor::error, (u64)0x8000000000000001);
+	check(odrive, ep::axis0::motor::config::pole_pairs, (s32)-7);
+	check(odrive, ep::axis0::encoder::config::mode, (u16)0x8001);
+	check(odrive, ep::can::error, (u8)200);
+	check(odrive, ep::axis0::config::enable_watchdog, true);
+	check(odrive, ep::axis1::controller::config::pos_gain, 12.5f);
+	ep::clear_errors.call(odrive);
+	u64 serial_number = ep::serial_number.get2(odrive);
+
+	if (odrive.communication_error)
+		printf("communication error\n");
+	printf("serial number %llu, %d values wrong\n", (unsigned long long)serial_number, failures);
+	return failures || odrive.communication_error ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -70,6 +70,18 @@ struct MonitorData
 
 
 	MonitorDataAxis axes[monitor_axes];
+
+	// Time between the setpoints of the first and the last axis arriving at ODrive. They are
+	// written in one burst at the start of each frame.
+	u32_micros setpoint_skew = 0;
+
+	// Problems on the link to ODrive in this frame (see LinkStats in ODrive.h). Together with
+	// delta_time_odrive, they tell a bad cable from slow responses of ODrive.
+	u32 link_crc_errors = 0;
+	u32 link_resyncs = 0;
+	u32 link_unexpected_responses = 0;
+	u32 link_timeouts = 0;
+	u32 link_resends = 0;
 };
 
 // ControlData below is mainly used to adjust the value of variables, but it is also used
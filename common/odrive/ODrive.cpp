@@ -1,5 +1,7 @@
 #include "ODrive.h"
-#include "json.hpp"
+#include "usb_async.h"
+#include "odrive_sim.h"
+#include "crc.h"
 
 #ifdef ODRIVE_INCLUDE_USB
 #ifdef _MSC_VER
@@ -16,15 +18,24 @@
 #endif
 #endif
 
+#ifdef _MSC_VER
+#include <direct.h>
+#else
+#include <sys/stat.h>
+#endif
+
 #ifdef ODRIVE_INCLUDE_UART
 #include <sys/fcntl.h>
 #include <termios.h>
 #include <unistd.h>
+#include <sys/select.h>
 #endif
 
 #include "../../common/time_helper.h"
+#include <algorithm>
+#include <math.h>
+#include <string.h>
 
-using nlohmann::json;
 
 #ifdef ODRIVE_INCLUDE_USB
 // ODrive specific USB Identifier:
@@ -84,12 +95,57 @@ libusb_device* check_usb_device_is_odrive(libusb_device* device, int pass,
 	return nullptr;
 }
 
-libusb_device_handle* get_odrive_usb_device(libusb_context* ctx,
+bool find_odrive_usb_interface(libusb_device* device,
+		int* usb_interface_out, int* usb_write_endpoint_out, int* usb_read_endpoint_out)
+{
+	for (int p = 0; p < 2; p++)
+	{
+		if (check_usb_device_is_odrive(device, p, usb_interface_out, usb_write_endpoint_out, usb_read_endpoint_out))
+			return true;
+	}
+	return false;
+}
+
+// Returns the serial number from the USB descriptor, which is the same hex string odrivetool shows.
+std::string get_usb_serial_number(libusb_device* device, libusb_device_handle* handle)
+{
+	libusb_device_descriptor desc;
+	if (libusb_get_device_descriptor(device, &desc) < 0 || desc.iSerialNumber == 0)
+		return "";
+	unsigned char serial[64];
+	int length = libusb_get_string_descriptor_ascii(handle, desc.iSerialNumber, serial, sizeof(serial));
+	if (length <= 0)
+		return "";
+	return std::string((const char*)serial, length);
+}
+
+bool serial_numbers_match(const std::string& a, const char* b)
+{
+	if (a.size() != strlen(b))
+		return false;
+	for (size_t i = 0; i < a.size(); i++)
+	{
+		if (toupper((unsigned char)a[i]) != toupper((unsigned char)b[i]))
+			return false;
+	}
+	return true;
+}
+
+void print_usb_permission_hint()
+{
+#ifndef _MSC_VER
+	printf("Try running this with sudo.\n");
+	printf("Alternatively, try following these steps: https://askubuntu.com/a/980887\n");
+	printf("With idVendor = %d and idProduct = %d\n", VID, PID);
+#endif
+}
+
+libusb_device_handle* get_odrive_usb_device(libusb_context* ctx, const char* serial,
 		int* usb_interface_out, int* usb_write_endpoint_out, int* usb_read_endpoint_out)
 {
-	// This function enumerates all usb devices and returns the first ODrive it finds.
+	// This function enumerates all usb devices and returns the first ODrive it finds, or the one with
+	// the given serial number.
 	// It also returns the interface number for fibre communication and the read and write endpoint number.
-	// In case you want to connect multiple ODrives via USB you will need to extend this function somehow...
 	// This code is roughly the same algorithm as this python code found in ODrive/Firmware/fibre/python/fibre/usbbulk_transport.py:
 /*
     self.cfg = self.dev.get_active_configuration()
@@ -128,30 +184,27 @@ libusb_device_handle* get_odrive_usb_device(libusb_context* ctx,
     )
 	*/
 
-	libusb_device* dev = nullptr;
 	libusb_device** devices; //pointer to pointer of device, used to retrieve a list of devices
 	ssize_t num_devices = libusb_get_device_list(ctx, &devices);
-	for (ssize_t i = 0; i < num_devices; i++)
-	{
-		for (int p = 0; p < 2; p++)
-		{
-			dev = check_usb_device_is_odrive(devices[i], p, usb_interface_out, usb_write_endpoint_out, usb_read_endpoint_out);
-			if (dev) break;
-		}
-		if (dev) break;
-	}
 	libusb_device_handle* handle = nullptr;
-	if (dev)
+	for (ssize_t i = 0; i < num_devices && !handle; i++)
 	{
+		libusb_device* dev = devices[i];
+		if (!find_odrive_usb_interface(dev, usb_interface_out, usb_write_endpoint_out, usb_read_endpoint_out))
+			continue;
 		libusb_open(dev, &handle);
 		if (!handle)
 		{
 			printf("Found ODrive via USB, but could not open it.\n");
-#ifndef _MSC_VER
-			printf("Try running this with sudo.\n");
-			printf("Alternatively, try following these steps: https://askubuntu.com/a/980887\n");
-			printf("With idVendor = %d and idProduct = %d\n", VID, PID);
-#endif
+			print_usb_permission_hint();
+			if (!serial)
+				break;
+			continue;
+		}
+		if (serial && !serial_numbers_match(get_usb_serial_number(dev, handle), serial))
+		{
+			libusb_close(handle);
+			handle = nullptr;
 		}
 	}
 	libusb_free_device_list(devices, 1);
@@ -159,7 +212,38 @@ libusb_device_handle* get_odrive_usb_device(libusb_context* ctx,
 }
 #endif
 
-bool ODrive::connect_usb()
+std::vector<ODriveUsbInfo> ODrive::enumerate_usb()
+{
+	std::vector<ODriveUsbInfo> result;
+#ifdef ODRIVE_INCLUDE_USB
+	libusb_context* ctx = nullptr;
+	if (libusb_init(&ctx) != 0)
+		return result;
+	libusb_device** devices;
+	ssize_t num_devices = libusb_get_device_list(ctx, &devices);
+	for (ssize_t i = 0; i < num_devices; i++)
+	{
+		libusb_device* dev = devices[i];
+		ODriveUsbInfo info;
+		if (!find_odrive_usb_interface(dev, &info.usb_interface, &info.write_endpoint, &info.read_endpoint))
+			continue;
+		info.bus = libusb_get_bus_number(dev);
+		info.address = libusb_get_device_address(dev);
+		libusb_device_handle* handle = nullptr;
+		if (libusb_open(dev, &handle) == 0)
+		{
+			info.serial = get_usb_serial_number(dev, handle);
+			libusb_close(handle);
+		}
+		result.push_back(info);
+	}
+	libusb_free_device_list(devices, 1);
+	libusb_exit(ctx);
+#endif
+	return result;
+}
+
+bool ODrive::connect_usb(const char* serial)
 {
 	close();
 #ifdef ODRIVE_INCLUDE_USB
@@ -169,10 +253,15 @@ bool ODrive::connect_usb()
 
 	//libusb_set_debug(ctx, LIBUSB_LOG_LEVEL_INFO);
 
-	usb_device = get_odrive_usb_device(ctx, &usb_interface, &usb_write_endpoint, &usb_read_endpoint);
+	if (serial && !*serial)
+		serial = nullptr;
+	usb_device = get_odrive_usb_device(ctx, serial, &usb_interface, &usb_write_endpoint, &usb_read_endpoint);
 	if (!usb_device)
 	{
-		printf("Cannot find ODrive via USB!\n");
+		if (serial)
+			printf("Cannot find ODrive with serial number %s via USB!\n", serial);
+		else
+			printf("Cannot find ODrive via USB!\n");
 		close();
 		return false;
 	}
@@ -192,6 +281,16 @@ bool ODrive::connect_usb()
 		close();
 		return false;
 	}
+	if (usb_async)
+	{
+		usb_transport = new UsbAsyncTransport;
+		if (!usb_transport->open(ctx, usb_device, usb_write_endpoint, usb_read_endpoint))
+		{
+			printf("Cannot start asynchronous USB transfers!\n");
+			close();
+			return false;
+		}
+	}
 	printf("Connecting to ODrive via USB... ");
 	fflush(stdout);
 	if (!get_json_interface())
@@ -207,9 +306,28 @@ bool ODrive::connect_usb()
 #endif
 }
 
+bool ODrive::connect_sim(ODriveSim* sim_)
+{
+	close();
+	sim = sim_;
+	printf("Connecting to simulated ODrive... ");
+	fflush(stdout);
+	if (!get_json_interface())
+	{
+		close();
+		return false;
+	}
+	is_connected = true;
+	return true;
+}
+
 void ODrive::close()
 {
+	sim = nullptr;
 #ifdef ODRIVE_INCLUDE_USB
+	// The transfers have to be cancelled before the device is closed.
+	delete usb_transport;
+	usb_transport = nullptr;
 	if (usb_device)
 	{
 		libusb_release_interface(usb_device, usb_interface);
@@ -224,17 +342,36 @@ void ODrive::close()
 	if (uart_file != -1)
 	    ::close(uart_file);
 	uart_file = -1;
+	uart_rx_length = 0;
 #endif
 	root = Endpoint();
+	endpoint_table.clear();
+	endpoints_by_id.clear();
+	typed_fallback_handles.clear();
+	shadow_values.clear();
+	callers.clear();
+	requests_in_flight.clear();
+	receiving = false;
+	foreground_unsent = 0;
+	{
+		std::lock_guard<std::mutex> lock(link_stats_mutex);
+		link_stats = LinkStats();
+	}
+	json_crc = 0;
+	rtt_measured = false;
+	smoothed_rtt = 0;
+	rtt_variance = 0;
+	retransmit_timeout = initial_retransmit_timeout;
+	uart_byte_time = 0;
+	ascii_protocol = false;
+	ascii_feedback_ids.clear();
 	is_connected = false;
 	communication_error = false;
 }
 
-bool ODrive::connect_uart(const char* uart_address, int baud_rate, bool stop_bits_2)
-{
-	close();
-
 #ifdef ODRIVE_INCLUDE_UART
+bool ODrive::open_uart(const char* uart_address, int baud_rate, bool stop_bits_2)
+{
 	int br;
 	switch (baud_rate)
 	{
@@ -246,7 +383,7 @@ bool ODrive::connect_uart(const char* uart_address, int baud_rate, bool stop_bit
 	case 1500000: br = B1500000; break;
 	case 2000000: br = B2000000; break;
 	default:
-		printf("Invalid baudrate: %d\n", br);
+		printf("Invalid baudrate: %d\n", baud_rate);
 		return false;
 	}
 
@@ -302,6 +439,8 @@ bool ODrive::connect_uart(const char* uart_address, int baud_rate, bool stop_bit
 		port_options.c_cflag |= CSTOPB; // 2 Stop bits 
 	else
 		port_options.c_cflag &= ~CSTOPB; // 1 Stop bit 
+	// Start bit, 8 data bits and the stop bits
+	uart_byte_time = (stop_bits_2 ? 11 : 10) * 1000000.0f / (float)baud_rate;
     port_options.c_cflag &= ~CSIZE;	            // Clears the mask for setting the data size             
     port_options.c_cflag |=  CS8;               // Set the data bits = 8                                 	 
     port_options.c_cflag &= ~CRTSCTS;           // No Hardware flow Control                         
@@ -338,6 +477,18 @@ bool ODrive::connect_uart(const char* uart_address, int baud_rate, bool stop_bit
     // Flush Buffers
     tcflush(uart_file, TCIFLUSH);
     tcflush(uart_file, TCIOFLUSH);
+	uart_rx_length = 0;
+	return true;
+}
+#endif
+
+bool ODrive::connect_uart(const char* uart_address, int baud_rate, bool stop_bits_2)
+{
+	close();
+
+#ifdef ODRIVE_INCLUDE_UART
+	if (!open_uart(uart_address, baud_rate, stop_bits_2))
+		return false;
 
 	printf("Connecting to ODrive via UART (%s)... ", uart_address);
 	if (!get_json_interface())
@@ -353,132 +504,525 @@ bool ODrive::connect_uart(const char* uart_address, int baud_rate, bool stop_bit
 #endif
 }
 
-static void populate_from_json(const json& j, Endpoint& endpoint)
+void ODrive::pipeline_begin()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	caller().pipeline_depth++;
+}
+
+bool ODrive::pipeline_end()
 {
-	for (const json& obj : j)
 	{
-		Endpoint new_child;
-		new_child.odrive = endpoint.odrive;
-		std::string name = obj["name"];
-		std::string type = obj["type"];
-		new_child.name = endpoint.name + "." + name;
-		new_child.type = type;
-		new_child.access = "none";
+		std::lock_guard<std::mutex> lock(mutex);
+		CallerState& state = caller();
+		assert(state.pipeline_depth > 0);
+		state.pipeline_depth--;
+		if (state.pipeline_depth)
+			return !communication_error;
+	}
+	return flush_requests();
+}
 
-		if (obj.count("access"))
-		{
-			//new_child.access = obj["access"]; // This line somehow doesn't compile in VS2019
-			std::string tmp = obj["access"];
-			new_child.access = std::move(tmp);
-		}
-		if (obj.count("id"))
-			new_child.id = obj["id"];
-		//std::cout << "Name: " << name << " type: " << type << " access: " << access << " id: " << id << std::endl;
-		endpoint.children[name] = std::move(new_child);
-		if (obj.count("members"))
+void ODrive::call_begin(int function_id)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	CallerState& state = caller();
+	state.pipeline_depth++;
+	state.call_function = function_id;
+}
+
+bool ODrive::call_end()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		caller().call_function = -1;
+	}
+	return pipeline_end();
+}
+
+void ODrive::set_synchronized(const EndpointHandle* handles, const float* values, int count, WriteTiming* timing)
+{
+	*timing = WriteTiming();
+	pipeline_begin();
+	for (int i = 0; i < count; i++)
+	{
+		if (handles[i].type != EndpointType::float32)
 		{
-			const json& members = obj["members"];
-			populate_from_json(members, endpoint.children[obj["name"]]);
+			communication_error = true;
+			printf("set_synchronized() needs float endpoints. ID: %d\n", handles[i].id);
+			break;
 		}
+		serial_buffer send_payload;
+		serialize(send_payload, values[i]);
+		queue_request(handles[i].id, send_payload, sizeof(float), true, timing, &on_write_timing);
 	}
+	pipeline_end();
+}
+
+ODrive::CallerState& ODrive::caller()
+{
+	return callers[std::this_thread::get_id()];
+}
+
+void ODrive::set_background_thread()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	caller().background = true;
+}
+
+void ODrive::end_thread()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	auto it = callers.find(std::this_thread::get_id());
+	if (it == callers.end())
+		return;
+	assert(it->second.pipeline_depth == 0 && it->second.requests.empty());
+	callers.erase(it);
+}
+
+void ODrive::on_write_timing(ODrive* odrive, void* value, const u8* payload, int length)
+{
+	((WriteTiming*)value)->record(time_micros_64());
+}
+
+void ODrive::on_raw_response(ODrive* odrive, void* value, const u8* payload, int length)
+{
+	serial_buffer& received_payload = *(serial_buffer*)value;
+	received_payload.resize(length);
+	memcpy(received_payload.data(), payload, length);
 }
 
 void ODrive::endpoint_request(int endpoint_id,
 		serial_buffer& received_payload, const serial_buffer& payload,
 		bool ack, int length, bool length_must_match)
 {
+	// This always waits for the response, even when pipelining. In that case everything that
+	// is queued so far is sent along.
+	received_payload.clear();
+	queue_request(endpoint_id, payload, length, length_must_match, &received_payload, &on_raw_response);
+	flush_requests();
+}
+
+bool ODrive::queue_request(int endpoint_id, const serial_buffer& payload, int length, bool length_must_match,
+		void* value, ResponseHandler on_response)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	CallerState& state = caller();
 	if (communication_error)
-		return;
+		return false;
+	bool shadowed = payload.size() && is_shadowed(endpoint_id);
+	if (shadowed)
+	{
+		const ShadowValue& shadow = shadow_values[endpoint_id];
+		if (shadow.valid && shadow.size == payload.size() && memcmp(shadow.bytes, payload.data(), shadow.size) == 0)
+		{
+			shadow_skipped_writes++;
+			return false;
+		}
+	}
 	endpoint_request_counter++;
-	
+	if (shadowed)
+		shadow_write(endpoint_id, payload, endpoint_request_counter);
+
 	// ODrive somehow sometimes sends corrupt data when the baudrate is about 921600 and ack is set to false,
 	// even if we don't read the response.
 	// Setting it to true fixes this completely.
-	ack = true;
-
-	if (ack)
-		endpoint_id |= 0x8000;
+	endpoint_id |= 0x8000;
 
 	seq_no = (seq_no + 1) & 0x7fff;
 	seq_no |= 0x80;
 
-	// Send the packet
-	const int max_bytes_to_receive = 64;
+	Request r;
+	r.seq_no = seq_no;
+	r.endpoint_id = endpoint_id;
+	r.length = length;
+	r.length_must_match = length_must_match;
+	r.sent = false;
+	r.done = false;
+	r.packet = create_odrive_packet(seq_no, endpoint_id, (u16)length, payload);
+	r.value = value;
+	r.on_response = on_response;
+	r.reads_value = payload.size() == 0 && length > 0;
+	r.number = endpoint_request_counter;
+	r.ascii_feedback = false;
+	r.call_function = state.call_function;
+	state.requests.push_back(std::move(r));
+	return state.pipeline_depth == 0;
+}
+
+// Whether requests[index] has to wait for the response to an earlier request of the same thread.
+// Accesses to the same endpoint are in flight one at a time, except for reads. Otherwise a write
+// that gets lost and is sent again could arrive after a later write or read of that endpoint.
+// A function call has three steps: the inputs are written, the function is triggered and the
+// outputs are read. Each waits for the step before it and for the previous call of the same
+// function, or a lost trigger would let the outputs be read before the function ran.
+bool ODrive::must_wait(const std::vector<Request>& requests, size_t num_done, size_t index) const
+{
+	auto call_step = [](const Request& r) { return r.reads_value ? 2 : (r.endpoint_id & 0x7fff) == r.call_function ? 1 : 0; };
+	const Request& r = requests[index];
+	for (size_t i = num_done; i < index; i++)
+	{
+		const Request& earlier = requests[i];
+		if (earlier.done)
+			continue;
+		if (earlier.endpoint_id == r.endpoint_id && !(earlier.reads_value && r.reads_value))
+			return true;
+		if (r.call_function != -1 && earlier.call_function == r.call_function && call_step(earlier) != call_step(r))
+			return true;
+	}
+	return false;
+}
+
+bool ODrive::flush_requests()
+{
+	// Sends the requests the calling thread queued and waits until all responses are received.
+	// The requests of all threads that are sent and not answered yet are in requests_in_flight.
+	// The thread that receives looks the responses up there, no matter which thread they belong
+	// to, and wakes up the others when it is done. A thread whose responses are received by
+	// another one just waits.
+	// At most max_requests_in_flight requests are sent before we wait for a response, so
+	// we don't overflow the receive buffer of ODrive.
+	std::unique_lock<std::mutex> lock(mutex);
+	CallerState& state = caller();
+	std::vector<Request>& requests = state.requests;
+#ifdef ODRIVE_INCLUDE_UART
+	if (ascii_protocol)
+		return flush_ascii_requests(lock, state);
+#endif
+	// Background threads wait until the others have sent their requests and leave them half of
+	// the slots.
+	const int max_in_flight = state.background ? std::max(1, max_requests_in_flight/2) : max_requests_in_flight;
+	if (!state.background)
+		foreground_unsent += (int)requests.size();
+	const int max_bytes_to_receive = max_packet_size;
 	u8 data[max_bytes_to_receive];
 	int received_bytes = 0;
-	serial_buffer packet = create_odrive_packet(seq_no, endpoint_id, (u16)length, payload);
+	size_t num_sent = 0, num_done = 0;
 	u32_micros start_time = time_micros();
-	while (true)
+	while (!communication_error)
 	{
-		if (time_micros() - start_time > 1000000)
+		while (num_sent < requests.size() && (int)requests_in_flight.size() < max_in_flight &&
+			(!state.background || foreground_unsent == 0) && !must_wait(requests, num_done, num_sent))
+		{
+			Request& r = requests[num_sent++];
+			send_to_odrive(r.packet);
+			r.sent = true;
+			r.resent = false;
+			r.send_time = time_micros_64();
+			r.last_send_time = r.send_time;
+			requests_in_flight.push_back(&r);
+			if (collect_stats)
+				stats_for(r.endpoint_id).bytes_sent += r.packet.size();
+			if (!state.background && --foreground_unsent == 0)
+				receive_cv.notify_all();
+		}
+		while (num_done < num_sent && requests[num_done].done)
+			num_done++;
+		if (num_done == requests.size())
+			break;
+
+		u32_micros elapsed = time_micros() - start_time;
+		if (elapsed > request_timeout)
 		{
 			communication_error = true;
-			received_payload.clear();
 			printf("endpoint request timeout\n");
-			return;
+			break;
 		}
-		send_to_odrive(packet);
-
-		if (!ack)
+		// A background thread that can't send yet may have nothing to receive.
+		if (receiving || requests_in_flight.empty())
 		{
-			received_payload.clear();
-			return;
+			receive_cv.wait_for(lock, std::chrono::microseconds(request_timeout - elapsed));
+			continue;
 		}
 
-		receive_again:
+		// The oldest request we are still waiting for determines the receive timeout. It runs from
+		// when that request was sent, otherwise the responses to the other threads could keep
+		// it from being sent again.
+		const Request& oldest = *requests_in_flight.front();
+		u32_micros timeout = receive_timeout(oldest.length);
+		u64_micros waited = time_micros_64() - oldest.last_send_time;
+		int oldest_endpoint_id = oldest.endpoint_id;
+
 		// Immediately wait for response from Odrive
-		bool r = receive_from_odrive(data, max_bytes_to_receive, &received_bytes, length);
+		bool r = false;
+		u64_micros receive_time = 0;
+		if (waited < timeout)
+		{
+			receiving = true;
+			lock.unlock();
+			r = receive_from_odrive(data, max_bytes_to_receive, &received_bytes, timeout - (u32_micros)waited);
+			receive_time = time_micros_64();
+			lock.lock();
+			receiving = false;
+			receive_cv.notify_all();
+		}
 		if (!r)
+		{
+			// The response got lost or was corrupted, send all requests we are waiting for again.
+			// Until a response arrives, each further timeout is twice as long.
+			retransmit_timeout = std::min(2*retransmit_timeout, max_retransmit_timeout);
+			count_link_event(&LinkStats::timeouts);
+			count_link_event(&LinkStats::resends, (u32)requests_in_flight.size());
+			if (collect_stats)
+				stats_for(oldest_endpoint_id).timeouts++;
+			for (Request* request : requests_in_flight)
+			{
+				send_to_odrive(request->packet);
+				request->resent = true;
+				request->last_send_time = time_micros_64();
+				if (collect_stats)
+				{
+					EndpointStats& stats = stats_for(request->endpoint_id);
+					stats.resends++;
+					stats.bytes_sent += request->packet.size();
+				}
+			}
 			continue;
+		}
 
 		if (communication_error)
 		{
 			printf("communication error!\n");
-			received_payload.clear();
-			return;
+			break;
 		}
 		if (received_bytes < 2)
 		{
-			printf("%d: unexpected length %d\n", endpoint_id, received_bytes);
+			printf("unexpected length %d\n", received_bytes);
 			communication_error = true;
-			received_payload.clear();
-			return;
+			break;
 		}
-		/*if (received_bytes-2 != length)
-		{
-			printf("%d: expected length %d, but received %d\n", endpoint_id, length, received_bytes-2);
-		}*/
 		u16 received_seq_no = 0;
 		serial_buffer_iterator it = data;
 		deserialize(it, received_seq_no);
-		if ((u16)((u16)seq_no | 0x8000) == (u16)received_seq_no+1)
-		{
-			// If a response takes longer than usual, we might timeout before we receive it.
-			// In that case the next request gets the old response and the sequence number is one off.
-			// So we just skip this response and read in the next.
-			//printf("%d: receive_again\n", endpoint_id);
-			goto receive_again;
-		}
-		if ((u16)((u16)seq_no | 0x8000) != (u16)received_seq_no)
+
+		size_t index = 0;
+		while (index < requests_in_flight.size() && (u16)(requests_in_flight[index]->seq_no | 0x8000) != received_seq_no)
+			index++;
+		if (index == requests_in_flight.size())
 		{
-			//communication_error = true;
-			//printf("%d: expected seq %d, but received %d\n", endpoint_id, ((u16)seq_no | 0x8000), received_seq_no);
+			// If a response takes longer than usual, we might timeout before we receive it and send
+			// the request again. In that case we get the same response twice or the response of an
+			// older request. We just skip these and read in the next one.
+			count_link_event(&LinkStats::unexpected_responses);
+			if (collect_stats)
+			{
+				int i = 0;
+				while (i < num_completed_requests && (u16)(completed_requests[i].seq_no | 0x8000) != received_seq_no)
+					i++;
+				if (i < num_completed_requests)
+					stats_for(completed_requests[i].endpoint_id).receive_again++;
+				else
+					unmatched_responses++;
+			}
 			continue;
-			//return;
 		}
+		Request* request = requests_in_flight[index];
 
-		if (length_must_match && received_bytes-2 != length)
+		if (request->length_must_match && received_bytes-2 != request->length)
 		{
 			communication_error = true;
-			received_payload.clear();
-			printf("%d: expected length %d, but received %d\n", endpoint_id, length, received_bytes-2);
-			return;
+			printf("%d: expected length %d, but received %d\n", request->endpoint_id, request->length, received_bytes-2);
+			break;
 		}
 
-		received_payload.resize(received_bytes-2);
-		memcpy(received_payload.data(), data+2, received_bytes-2);
-		break;
+		// The round trip is measured from when the request was sent, not from when we started
+		// waiting. With pipelining, the later responses are already on their way by then.
+		// Karn's algorithm: If the request was sent more than once, we don't know which one
+		// this is the response to, so the time can't be used.
+		u32_micros round_trip_time = (u32_micros)(receive_time - request->send_time);
+		if (!request->resent)
+			update_retransmit_timeout(round_trip_time, received_bytes);
+		if (collect_stats)
+		{
+			EndpointStats& stats = stats_for(request->endpoint_id);
+			stats.requests++;
+			stats.bytes_received += received_bytes;
+			stats.last_latency = round_trip_time;
+			stats.last_response_time = receive_time;
+			stats.latency.record(stats.last_latency);
+		}
+		if (request->on_response)
+			request->on_response(this, request->value, data+2, received_bytes-2);
+		if (request->reads_value && is_shadowed(request->endpoint_id & 0x7fff))
+			shadow_read(request->endpoint_id & 0x7fff, data+2, received_bytes-2, request->number);
+		request->done = true;
+		completed_requests[completed_index] = {request->seq_no, request->endpoint_id};
+		completed_index = (completed_index+1) % num_completed_requests;
+		requests_in_flight.erase(requests_in_flight.begin() + index);
+	}
+	// After an error, requests of this thread can still be in flight. Nobody may touch them
+	// once this returns.
+	if (num_done < requests.size())
+	{
+		const Request* begin = requests.data();
+		const Request* end = begin + requests.size();
+		requests_in_flight.erase(std::remove_if(requests_in_flight.begin(), requests_in_flight.end(),
+			[&](const Request* r) { return r >= begin && r < end; }), requests_in_flight.end());
+		receive_cv.notify_all();
+	}
+	if (!state.background && num_sent < requests.size())
+	{
+		foreground_unsent -= (int)(requests.size() - num_sent);
+		receive_cv.notify_all();
+	}
+	requests.clear();
+	// We don't know which of the writes arrived.
+	if (communication_error)
+		invalidate_shadow_locked();
+	return !communication_error;
+}
+
+void ODrive::enable_shadow(const Endpoint& endpoint)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	enable_shadow_locked(endpoint);
+}
+
+void ODrive::enable_shadow_locked(const Endpoint& endpoint)
+{
+	for (int i = 0; i < endpoint.num_children; i++)
+		enable_shadow_locked(endpoint.children[i]);
+	EndpointHandle h = endpoint.handle();
+	int size = endpoint_type_size(h.type);
+	if (!h.is_valid() || size == 0)
+		return;
+	if (h.id >= (int)shadow_values.size())
+		shadow_values.resize(h.id+1);
+	ShadowValue& shadow = shadow_values[h.id];
+	shadow.enabled = true;
+	shadow.valid = false;
+	shadow.size = (u8)size;
+}
+
+void ODrive::invalidate_shadow()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	invalidate_shadow_locked();
+}
+
+void ODrive::invalidate_shadow_locked()
+{
+	for (ShadowValue& shadow : shadow_values)
+		shadow.valid = false;
+}
+
+void ODrive::invalidate_shadow(const EndpointHandle& handle)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	if (handle.id >= 0 && handle.id < (int)shadow_values.size())
+		shadow_values[handle.id].valid = false;
+}
+
+void ODrive::shadow_write(int endpoint_id, const serial_buffer& payload, int number)
+{
+	ShadowValue& shadow = shadow_values[endpoint_id];
+	shadow.last_write = number;
+	shadow.valid = shadow.size == payload.size();
+	if (shadow.valid)
+		memcpy(shadow.bytes, payload.data(), shadow.size);
+}
+
+void ODrive::shadow_read(int endpoint_id, const u8* payload, int length, int number)
+{
+	// A read that was queued before the last write returns the value from before the write.
+	ShadowValue& shadow = shadow_values[endpoint_id];
+	if (shadow.size != length || number < shadow.last_write)
+		return;
+	shadow.valid = true;
+	memcpy(shadow.bytes, payload, length);
+}
+
+EndpointStats& ODrive::stats_for(int endpoint_id)
+{
+	endpoint_id &= 0x7fff;
+	if (endpoint_id >= (int)endpoint_stats.size())
+		endpoint_stats.resize(endpoint_id+1);
+	return endpoint_stats[endpoint_id];
+}
+
+LinkStats ODrive::get_link_stats() const
+{
+	std::lock_guard<std::mutex> lock(link_stats_mutex);
+	return link_stats;
+}
+
+void ODrive::count_link_event(u32 LinkStats::*counter, u32 count)
+{
+	std::lock_guard<std::mutex> lock(link_stats_mutex);
+	link_stats.*counter += count;
+}
+
+void ODrive::reset_stats()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	endpoint_stats.clear();
+	unmatched_responses = 0;
+}
+
+const Endpoint* ODrive::endpoint_by_id(int endpoint_id) const
+{
+	if (endpoint_id < 0 || endpoint_id >= (int)endpoints_by_id.size())
+		return nullptr;
+	return endpoints_by_id[endpoint_id];
+}
+
+EndpointHandle ODrive::typed_fallback_handle(int generated_id, const char* path)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	if (generated_id >= (int)typed_fallback_handles.size())
+		typed_fallback_handles.resize(generated_id+1);
+	EndpointHandle& h = typed_fallback_handles[generated_id];
+	// odrive is set once the lookup was done, even if the endpoint doesn't exist. Then the
+	// handle stays invalid and every access sets communication_error.
+	if (!h.odrive)
+	{
+		const Endpoint* endpoint = root.find(path);
+		if (endpoint)
+			h = endpoint->handle();
+		else
+			printf("odrive: cannot find %s, the firmware doesn't match the generated endpoints\n", path);
+		h.odrive = this;
+	}
+	return h;
+}
+
+void ODrive::print_slowest_endpoints(int n, u64_micros since) const
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	std::vector<int> ids;
+	for (int id = 0; id < (int)endpoint_stats.size(); id++)
+	{
+		const EndpointStats& stats = endpoint_stats[id];
+		if (stats.requests && stats.last_response_time >= since)
+			ids.push_back(id);
+	}
+	auto slower = [&](int a, int b)
+	{
+		const EndpointStats& sa = endpoint_stats[a];
+		const EndpointStats& sb = endpoint_stats[b];
+		if (since)
+			return sa.last_latency > sb.last_latency;
+		return sa.latency.percentile(0.99f) > sb.latency.percentile(0.99f);
+	};
+	std::sort(ids.begin(), ids.end(), slower);
+	if ((int)ids.size() > n)
+		ids.resize(n);
+
+	printf("%-50s %8s %7s %7s %7s %7s %7s %7s %7s %7s\n", "endpoint", "requests", "mean", "p50", "p99", "max", "last",
+		"resends", "timeout", "again");
+	for (int id : ids)
+	{
+		const EndpointStats& stats = endpoint_stats[id];
+		const Endpoint* endpoint = endpoint_by_id(id);
+		std::string name = endpoint ? endpoint->name : std::to_string(id);
+		printf("%-50s %8u %7u %7u %7u %7u %7u %7u %7u %7u\n", name.c_str(), stats.requests,
+			stats.latency.mean(), stats.latency.percentile(0.5f), stats.latency.percentile(0.99f),
+			stats.latency.max_micros, stats.last_latency, stats.resends, stats.timeouts, stats.receive_again);
 	}
+	if (unmatched_responses)
+		printf("unmatched responses: %u\n", unmatched_responses);
+	if (shadow_skipped_writes)
+		printf("skipped writes (shadow values): %u\n", shadow_skipped_writes);
 }
 
 inline u16 firmware_id_to_crc(int id)
@@ -486,13 +1030,57 @@ inline u16 firmware_id_to_crc(int id)
 	return (u16)((id >> 16) & 0xffff);
 }
 
+static std::string json_cache_filename(const std::string& folder, int json_id)
+{
+	char buffer[64];
+	sprintf_s(buffer, "/odrive_interface_%08x.json", (u32)json_id);
+	return folder + buffer;
+}
+
+static bool load_file(const char* filename, std::vector<u8>& json_data)
+{
+	FILE* file = fopen(filename, "rb");
+	if (!file)
+		return false;
+	fseek(file, 0, SEEK_END);
+	long size = ftell(file);
+	fseek(file, 0, SEEK_SET);
+	json_data.resize(size > 0 ? size : 0);
+	bool ok = size > 0 && fread(json_data.data(), size, 1, file) == 1;
+	fclose(file);
+	return ok;
+}
+
+static bool load_json_cache(const std::string& folder, int json_id, std::vector<u8>& json_data)
+{
+	return load_file(json_cache_filename(folder, json_id).c_str(), json_data);
+}
+
+static void save_json_cache(const std::string& folder, int json_id, const std::vector<u8>& json_data)
+{
+#ifdef _MSC_VER
+	_mkdir(folder.c_str());
+#else
+	mkdir(folder.c_str(), 0755);
+#endif
+	std::string filename = json_cache_filename(folder, json_id);
+	FILE* file = fopen(filename.c_str(), "wb");
+	if (!file)
+	{
+		printf("Cannot write json cache file %s\n", filename.c_str());
+		return;
+	}
+	fwrite(json_data.data(), json_data.size(), 1, file);
+	fclose(file);
+}
+
 bool ODrive::get_json_interface()
 {
 	//printf("get_json_interface...\n");
 
 	serial_buffer send_payload;
 	serial_buffer receive_payload;
-	serial_buffer received_json;
+	std::vector<u8> received_json;
 
 	int crc = 0;
 	{
@@ -505,212 +1093,173 @@ bool ODrive::get_json_interface()
 		deserialize(it, crc);
 	}
 	firmware_crc = firmware_id_to_crc(crc);
+	json_crc = (u32)crc;
 
+	// The json is identified by the crc, so if we have a file for it already, we don't need to download it.
 	u32_micros start_time = time_micros();
-	do {
-		serialize(send_payload, (int)received_json.size());
-		endpoint_request(0, receive_payload, send_payload, true, 64, false);
-		send_payload.clear();
-		for (u8 byte : receive_payload)
+	bool parsed = false;
+	if (json_cache_folder.size() && !json_cache_refresh &&
+		load_json_cache(json_cache_folder, crc, received_json))
+	{
+		parsed = endpoint_table.parse((const char*)received_json.data(), received_json.size(), this);
+		if (!parsed)
+			printf("ignoring invalid json cache file... ");
+		else
+			printf("done (cached). time: %dms\n", (int)((time_micros() - start_time) * .001f));
+		received_json.clear();
+	}
+
+	if (!parsed)
+	{
+		if (!download_json_interface(received_json))
+			return false;
+		if (!endpoint_table.parse((const char*)received_json.data(), received_json.size(), this))
 		{
-			received_json.push_back(byte);
-			//printf("%c", byte);
-			//fflush(stdout);
+			printf("invalid json!\n");
+			communication_error = true;
+			return false;
 		}
-	} while (receive_payload.size());
-	printf("done. time: %dms\n", (int)((time_micros() - start_time) * .001f));
-	if (communication_error)
-		return false;
+		if (json_cache_folder.size())
+			save_json_cache(json_cache_folder, crc, received_json);
+	}
+	//printf("Received %i bytes!\n", received_json.size());
+	return init_endpoints();
+}
 
-	bool allow_exceptions = false;
-	json j = json::parse(received_json, nullptr, allow_exceptions);
-	if (j.is_discarded())
+bool ODrive::init_endpoints()
+{
+	root = endpoint_table.root;
+	endpoints_by_id.clear();
+	for (const Endpoint& endpoint : endpoint_table.endpoints)
 	{
-		printf("invalid json!\n");
-		communication_error = true;
-		return false;
+		if (endpoint.id < 0)
+			continue;
+		if (endpoint.id >= (int)endpoints_by_id.size())
+			endpoints_by_id.resize(endpoint.id+1, nullptr);
+		endpoints_by_id[endpoint.id] = &endpoint;
+	}
+	typed_fallback_handles.clear();
+
+	// Both reads go out as one "f" command if the ASCII protocol is used.
+	ascii_feedback_ids.clear();
+	for (int a = 0; ; a++)
+	{
+		char path[32];
+		sprintf_s(path, "axis%d", a);
+		const Endpoint* axis = root.find(path);
+		if (!axis)
+			break;
+		const Endpoint* pos_estimate = axis->find("encoder.pos_estimate");
+		const Endpoint* vel_estimate = axis->find("encoder.vel_estimate");
+		AsciiFeedbackIds ids;
+		if (pos_estimate && vel_estimate)
+		{
+			ids.pos_estimate = pos_estimate->id;
+			ids.vel_estimate = vel_estimate->id;
+		}
+		ascii_feedback_ids.push_back(ids);
 	}
-	//printf("Received %i bytes!\n", received_json.size());
-	root = Endpoint();
-	root.odrive = this;
-	populate_from_json(j, root);
 
 	u8 odrive_fw_version_major = 0;
 	u8 odrive_fw_version_minor = 0;
 	u8 odrive_fw_version_revision = 0;
+	odrive_fw_is_milana = false;
+	pipeline_begin();
 	root("fw_version_major"   ).get(odrive_fw_version_major);
 	root("fw_version_minor"   ).get(odrive_fw_version_minor);
 	root("fw_version_revision").get(odrive_fw_version_revision);
-	odrive_fw_version = odrive_fw_version_major*1000000 + odrive_fw_version_minor*1000 + odrive_fw_version_revision;
-
-	odrive_fw_is_milana = false;
 	if (root.has_child("fw_version_milana"))
 		root("fw_version_milana").get(odrive_fw_is_milana);
+	pipeline_end();
+	odrive_fw_version = odrive_fw_version_major*1000000 + odrive_fw_version_minor*1000 + odrive_fw_version_revision;
 	//printf("odrive_fw_version: %d Milana: %d\n", odrive_fw_version, (int)odrive_fw_is_milana);
 	return !communication_error;
 }
 
-
-void ODrive::call(int id)
+bool ODrive::connect_uart_ascii(const char* uart_address, int baud_rate, bool stop_bits_2, const char* json_filename)
 {
-	// call
-	serial_buffer send_payload;
-	serial_buffer receive_payload;
-	endpoint_request(id, receive_payload, send_payload, false, 0);
-}
+	close();
 
-void ODrive::call(int id, int in1, float* out1)
-{
-	*out1 = 0;
-	{
-		// param1
-		serial_buffer send_payload;
-		serial_buffer receive_payload;
-		serialize(send_payload, in1);
-		endpoint_request(id+1, receive_payload, send_payload, false, 0);
-	}
-	{
-		// call
-		serial_buffer send_payload;
-		serial_buffer receive_payload;
-		endpoint_request(id, receive_payload, send_payload, false, 0);
-	}
-	{
-		// return
-		serial_buffer send_payload;
-		serial_buffer receive_payload;
-		endpoint_request(id+2, receive_payload, send_payload, true, sizeof(*out1));
-		if (communication_error) return;
-		auto it = get_it(receive_payload);
-		deserialize(it, *out1);
-	}
-}
-void ODrive::call(int id, int in1, u64* out1)
-{
-	*out1 = 0;
-	{
-		// param1
-		serial_buffer send_payload;
-		serial_buffer receive_payload;
-		serialize(send_payload, in1);
-		endpoint_request(id+1, receive_payload, send_payload, false, 0);
-	}
-	{
-		// call
-		serial_buffer send_payload;
-		serial_buffer receive_payload;
-		endpoint_request(id, receive_payload, send_payload, false, 0);
-	}
+#ifdef ODRIVE_INCLUDE_UART
+	std::vector<u8> json_data;
+	if (!load_file(json_filename, json_data) ||
+		!endpoint_table.parse((const char*)json_data.data(), json_data.size(), this))
 	{
-		// return
-		serial_buffer send_payload;
-		serial_buffer receive_payload;
-		endpoint_request(id+2, receive_payload, send_payload, true, sizeof(*out1));
-		if (communication_error) return;
-		auto it = get_it(receive_payload);
-		deserialize(it, *out1);
+		printf("Cannot load the json interface from %s\n", json_filename);
+		close();
+		return false;
 	}
-}
-
-void ODrive::call(int id, bool* out1)
-{
-	*out1 = 0;
+	if (!open_uart(uart_address, baud_rate, stop_bits_2))
 	{
-		// call
-		serial_buffer send_payload;
-		serial_buffer receive_payload;
-		endpoint_request(id, receive_payload, send_payload, false, 0);
+		close();
+		return false;
 	}
+	printf("Connecting to ODrive via UART with the ASCII protocol (%s)...\n", uart_address);
+	ascii_protocol = true;
+	if (!init_endpoints())
 	{
-		// return
-		serial_buffer send_payload;
-		serial_buffer receive_payload;
-		endpoint_request(id+1, receive_payload, send_payload, true, sizeof(*out1));
-		if (communication_error) return;
-		auto it = get_it(receive_payload);
-		deserialize(it, *out1);
+		printf("ODrive doesn't answer, is the UART set to the ASCII protocol?\n");
+		close();
+		return false;
 	}
+	is_connected = true;
+	return true;
+#else
+	printf("Cannot connect to ODrive via UART. Feature is not implemented on Windows yet!\n");
+	return false;
+#endif
 }
 
-// Calculates an arbitrary CRC for one byte.
-// Adapted from https://barrgroup.com/Embedded-Systems/How-To/CRC-Calculation-C-Code
-template<typename T, unsigned POLYNOMIAL>
-static T calc_crc(T remainder, uint8_t value)
+bool ODrive::download_json_interface(std::vector<u8>& received_json)
 {
-    constexpr T BIT_WIDTH = (8 * sizeof(T));
-    constexpr T TOPBIT = ((T)1 << (BIT_WIDTH - 1));
-    
-    // Bring the next byte into the remainder.
-    remainder ^= (value << (BIT_WIDTH - 8));
-
-    // Perform modulo-2 division, a bit at a time.
-    for (uint8_t bit = 8; bit; --bit) {
-        if (remainder & TOPBIT) {
-            remainder = (remainder << 1) ^ POLYNOMIAL;
-        } else {
-            remainder = (remainder << 1);
-        }
-    }
-
-    return remainder;
-}
-
-template<typename T, unsigned POLYNOMIAL>
-static T calc_crc(T remainder, const uint8_t* buffer, size_t length) {
-    while (length--)
-        remainder = calc_crc<T, POLYNOMIAL>(remainder, *(buffer++));
-    return remainder;
-}
-
-template<unsigned POLYNOMIAL>
-static uint8_t calc_crc8(uint8_t remainder, uint8_t value) {
-    return calc_crc<uint8_t, POLYNOMIAL>(remainder, value);
-}
-
-template<unsigned POLYNOMIAL>
-static uint16_t calc_crc16(uint16_t remainder, uint8_t value) {
-    return calc_crc<uint16_t, POLYNOMIAL>(remainder, value);
+	serial_buffer send_payload;
+	serial_buffer receive_payload;
+	u32_micros start_time = time_micros();
+	do {
+		serialize(send_payload, (int)received_json.size());
+		endpoint_request(0, receive_payload, send_payload, true, 64, false);
+		send_payload.clear();
+		for (u8 byte : receive_payload)
+		{
+			received_json.push_back(byte);
+			//printf("%c", byte);
+			//fflush(stdout);
+		}
+	} while (receive_payload.size());
+	printf("done. time: %dms\n", (int)((time_micros() - start_time) * .001f));
+	return !communication_error;
 }
 
-template<unsigned POLYNOMIAL>
-static uint8_t calc_crc8(uint8_t remainder, const uint8_t* buffer, size_t length) {
-    return calc_crc<uint8_t, POLYNOMIAL>(remainder, buffer, length);
-}
 
-template<unsigned POLYNOMIAL>
-static uint16_t calc_crc16(uint16_t remainder, const uint8_t* buffer, size_t length) {
-    return calc_crc<uint16_t, POLYNOMIAL>(remainder, buffer, length);
+void ODrive::call(int id)
+{
+	// The call itself is pipelined like a set. Parameters and return values are separate
+	// endpoints, Endpoint::call() takes care of them.
+	serial_buffer send_payload;
+	if (queue_request(id, send_payload, 0, true, nullptr, nullptr))
+		flush_requests();
 }
 
-constexpr uint8_t CANONICAL_CRC8_POLYNOMIAL = 0x37;
-constexpr uint8_t CANONICAL_CRC8_INIT = 0x42;
-constexpr uint16_t CANONICAL_CRC16_POLYNOMIAL = 0x3d65;
-constexpr uint16_t CANONICAL_CRC16_INIT = 0x1337;
-
-std::vector<u8> ODrive::packet_to_stream(std::vector<u8>& packet)
+stream_buffer ODrive::packet_to_stream(const serial_buffer& packet)
 {
-	assert(packet.size() < 128);
-
-	serial_buffer data;
-	data.reserve(3+packet.size()+2);
-
-	serialize(data, (u8)0xaa);
-	serialize(data, (u8)packet.size());
+	stream_buffer data;
+	data.push_back(0xaa);
+	data.push_back((u8)packet.size());
     u8 crc8 = calc_crc8<CANONICAL_CRC8_POLYNOMIAL>(CANONICAL_CRC8_INIT, data.data(), 2);
-	serialize(data, crc8);
+	data.push_back(crc8);
 
 	for (u8 b : packet)
 		data.push_back(b);
 
     u16 crc16 = calc_crc16<CANONICAL_CRC16_POLYNOMIAL>(CANONICAL_CRC16_INIT, packet.data(), packet.size());
-    serialize(data, (u8)((crc16 >> 8) & 0xff));
-    serialize(data, (u8)((crc16 >> 0) & 0xff));
+    data.push_back((u8)((crc16 >> 8) & 0xff));
+    data.push_back((u8)((crc16 >> 0) & 0xff));
 	return data;
 }
 
-int ODrive::stream_to_packet(std::vector<u8>& stream, u8* packet, int max_length)
+int ODrive::stream_to_packet(const u8* stream, int stream_length, u8* packet, int max_length)
 {
-	if (stream.size() >= 128 || stream.size() >= max_length+5 || stream.size() < 5)
+	if (stream_length >= 128 || stream_length > max_length+5 || stream_length < 5)
 	{
 		//printf("invalid stream packet size %d\n", stream.size());
 		//for (int i = 0; i < stream.size(); i++)
@@ -723,46 +1272,59 @@ int ODrive::stream_to_packet(std::vector<u8>& stream, u8* packet, int max_length
 		//printf("invalid stream packet 1!\n");
 		return -1;
 	}
-	if (stream[1] != stream.size()-5)
+	if (stream[1] != stream_length-5)
 	{
-		//printf("invalid stream packet 2! %d %d\n", stream[1], stream.size()-5);
+		//printf("invalid stream packet 2! %d %d\n", stream[1], stream_length-5);
 		return -1;
 	}
-    u8 crc8 = calc_crc8<CANONICAL_CRC8_POLYNOMIAL>(CANONICAL_CRC8_INIT, stream.data(), 2);
+    u8 crc8 = calc_crc8<CANONICAL_CRC8_POLYNOMIAL>(CANONICAL_CRC8_INIT, stream, 2);
 	if (stream[2] != crc8)
 	{
 		//printf("invalid stream packet 3! 0x%x!=0x%x\n", stream[2], crc8);
 		return -1;
 	}
-    u16 crc16_1 = calc_crc16<CANONICAL_CRC16_POLYNOMIAL>(CANONICAL_CRC16_INIT, stream.data()+3, stream.size()-5);
+    u16 crc16_1 = calc_crc16<CANONICAL_CRC16_POLYNOMIAL>(CANONICAL_CRC16_INIT, stream+3, stream_length-5);
     u16 crc16_2;
-	crc16_2 = ((u16)stream[stream.size()-2]) << 8;
-	crc16_2 |= stream[stream.size()-1] << 0;
+	crc16_2 = ((u16)stream[stream_length-2]) << 8;
+	crc16_2 |= stream[stream_length-1] << 0;
 	if (crc16_1 != crc16_2)
 	{
-		//printf("invalid stream packet 4! %d %d  0x%x!=0x%x\n", stream.size(), max_length, crc16_1, crc16_2);
-		//for (int i = 0; i < stream.size(); i++)
+		//printf("invalid stream packet 4! %d %d  0x%x!=0x%x\n", stream_length, max_length, crc16_1, crc16_2);
+		//for (int i = 0; i < stream_length; i++)
 		//	printf("0x%02x\n", stream[i]);
 		//printf("\n");
 		return -1;
 	}
-	memcpy(packet, stream.data()+3, stream.size()-5);
-	return (int)stream.size()-5;
+	memcpy(packet, stream+3, stream_length-5);
+	return stream_length-5;
 }
 
 
-void ODrive::send_to_odrive(std::vector<u8>& packet)
+void ODrive::send_to_odrive(const serial_buffer& packet)
 {
+	if (sim)
+	{
+		std::lock_guard<std::mutex> lock(sim_mutex);
+		sim->handle_packet(packet.data(), packet.size(), time_micros_64());
+		return;
+	}
 #ifdef ODRIVE_INCLUDE_USB
-	if (usb_device)
+	if (usb_transport)
+	{
+		if (!usb_transport->send(packet.data(), packet.size(), request_timeout))
+			communication_error = true;
+	}
+	else if (usb_device)
 	{
+		// With a timeout of 0 this would block forever if ODrive stops reading.
+		const unsigned int send_timeout_ms = std::max(1u, (unsigned int)(request_timeout / 1000));
 		int sent_bytes = 0;
 		int r = libusb_bulk_transfer(usb_device,
 			usb_write_endpoint,
-			packet.data(),
-			(int)packet.size(),
+			(u8*)packet.data(),
+			packet.size(),
 			&sent_bytes,
-			0);
+			send_timeout_ms);
 		if (r != 0 || sent_bytes != packet.size())
 		{
 			communication_error = true;
@@ -773,7 +1335,7 @@ void ODrive::send_to_odrive(std::vector<u8>& packet)
 #ifdef ODRIVE_INCLUDE_UART
 	if (uart_file != -1)
 	{
-		std::vector<u8> stream_packet = packet_to_stream(packet);
+		stream_buffer stream_packet = packet_to_stream(packet);
 		int sent_bytes = write(uart_file, stream_packet.data(), stream_packet.size());
 		//printf("done\n");
 		if (sent_bytes != stream_packet.size())
@@ -786,21 +1348,169 @@ void ODrive::send_to_odrive(std::vector<u8>& packet)
 }
 
 
-bool ODrive::receive_from_odrive(u8* packet, int max_bytes_to_receive, int* received_bytes, int expected_length)
+#ifdef ODRIVE_INCLUDE_UART
+// Sleeps until there is something to read or the timeout has passed. select() is used instead
+// of poll(), because the timeouts here are below a millisecond.
+static bool uart_wait_readable(int file, u32_micros timeout)
+{
+	fd_set read_set;
+	FD_ZERO(&read_set);
+	FD_SET(file, &read_set);
+	timeval tv = {(time_t)(timeout/1000000), (suseconds_t)(timeout%1000000)};
+	return select(file+1, &read_set, nullptr, nullptr, &tv) > 0;
+}
+#endif
+
+// Searches the stream for the next valid frame. Bytes in front of it that don't belong to a
+// valid frame are skipped. *consumed is how many bytes can be dropped from the front of the
+// stream, which excludes an incomplete frame at the end.
+bool ODrive::find_stream_packet(const u8* stream, int stream_length, u8* packet, int max_length, int* packet_length, int* consumed, bool* skipped,
+	u32* crc_errors)
+{
+	int pos = 0;
+	bool found = false;
+	*skipped = false;
+	while (pos < stream_length)
+	{
+		const u8* frame = stream+pos;
+		int available = stream_length-pos;
+		if (frame[0] != 0xaa)
+		{
+			pos++;
+			*skipped = true;
+			continue;
+		}
+		if (available < 3)
+			break;
+		// The length byte can only be trusted once the header crc matches.
+		if (frame[1] > max_packet_size || frame[2] != calc_crc8<CANONICAL_CRC8_POLYNOMIAL>(CANONICAL_CRC8_INIT, frame, 2))
+		{
+			pos++;
+			*skipped = true;
+			continue;
+		}
+		int frame_length = frame[1]+5;
+		if (available < frame_length)
+			break;
+		int length = stream_to_packet(frame, frame_length, packet, max_length);
+		if (length < 0)
+		{
+			// The header is valid, so this is most likely a frame that was corrupted on the way.
+			if (crc_errors)
+				(*crc_errors)++;
+			// The 0xaa could have been part of the payload of a broken frame, so search again from the next byte.
+			pos++;
+			*skipped = true;
+			continue;
+		}
+		*packet_length = length;
+		pos += frame_length;
+		found = true;
+		break;
+	}
+	*consumed = pos;
+	return found;
+}
+
+#ifdef ODRIVE_INCLUDE_UART
+// Takes the next valid frame out of uart_rx_buffer. Bytes after it are kept for the next call.
+bool ODrive::parse_uart_frame(u8* packet, int max_length, int* packet_length)
+{
+	int consumed;
+	bool skipped;
+	u32 crc_errors = 0;
+	bool found = find_stream_packet(uart_rx_buffer, uart_rx_length, packet, max_length, packet_length, &consumed, &skipped, &crc_errors);
+	if (skipped)
+		count_link_event(&LinkStats::resyncs);
+	if (crc_errors)
+		count_link_event(&LinkStats::crc_errors, crc_errors);
+	memmove(uart_rx_buffer, uart_rx_buffer+consumed, uart_rx_length-consumed);
+	uart_rx_length -= consumed;
+	return found;
+}
+#endif
+
+u32_micros ODrive::uart_transfer_time(int packet_length) const
+{
+	// The UART frame has 5 more bytes than the packet.
+	return (u32_micros)((packet_length+5) * uart_byte_time);
+}
+
+u32_micros ODrive::receive_timeout(int expected_length) const
+{
+	// The response has the sequence number in front of the payload.
+	return retransmit_timeout + uart_transfer_time(expected_length+2);
+}
+
+void ODrive::update_retransmit_timeout(u32_micros round_trip_time, int received_bytes)
+{
+	// Like TCP (RFC 6298), but without the transfer time of the response, which only depends on its length.
+	u32_micros transfer_time = uart_transfer_time(received_bytes);
+	float sample = round_trip_time > transfer_time ? (float)(round_trip_time - transfer_time) : 0.0f;
+	if (!rtt_measured)
+	{
+		rtt_measured = true;
+		smoothed_rtt = sample;
+		rtt_variance = sample/2;
+	}
+	else
+	{
+		rtt_variance = 0.75f*rtt_variance + 0.25f*fabsf(smoothed_rtt - sample);
+		smoothed_rtt = 0.875f*smoothed_rtt + 0.125f*sample;
+	}
+	u32_micros timeout = (u32_micros)(smoothed_rtt + 4*rtt_variance);
+	retransmit_timeout = std::min(std::max(timeout, min_retransmit_timeout), max_retransmit_timeout);
+}
+
+bool ODrive::receive_from_odrive(u8* packet, int max_bytes_to_receive, int* received_bytes, u32_micros timeout)
 {
 	// returns false if the packet to odrive should be resent
 	//printf("recv...\n");
+	if (sim)
+	{
+		// Lost packets are handled like with UART, after a timeout the request is sent again.
+		u64_micros deadline = time_micros_64() + timeout;
+		std::unique_lock<std::mutex> lock(sim_mutex);
+		while (!sim->receive_response(packet, max_bytes_to_receive, received_bytes, time_micros_64()))
+		{
+			u64_micros now = time_micros_64();
+			if (now >= deadline)
+				return false;
+			u64_micros next = sim->next_response_time();
+			u64_micros wake_time = next && next < deadline ? next : deadline;
+			if (wake_time > now)
+			{
+				lock.unlock();
+				precise_sleep((double)(wake_time-now) * .000001);
+				lock.lock();
+			}
+		}
+		return true;
+	}
 #ifdef ODRIVE_INCLUDE_USB
+	if (usb_transport)
+	{
+		// Like with UART, a timeout only means the requests are sent again.
+		int r = usb_transport->receive(packet, max_bytes_to_receive, received_bytes, timeout);
+		if (r == -1)
+		{
+			communication_error = true;
+			printf("usb receive failed\n");
+		}
+		return r == 1;
+	}
 	if (usb_device)
 	{
-		const int timeout = 1000;
+		// libusb counts in milliseconds and 0 would wait forever, so this is rounded up. Like with
+		// UART, a timeout only means the requests are sent again.
+		const unsigned int receive_timeout_ms = (timeout + 999) / 1000;
 		int r = libusb_bulk_transfer(usb_device,
 			usb_read_endpoint,
 			packet,
 			max_bytes_to_receive,
 			received_bytes,
-			timeout);
-		if (r != 0)
+			std::max(1u, receive_timeout_ms));
+		if (r != 0 && r != LIBUSB_ERROR_TIMEOUT)
 		{
 			communication_error = true;
 			printf("libusb_bulk_transfer recv return %d\n", r);
@@ -811,20 +1521,26 @@ bool ODrive::receive_from_odrive(u8* packet, int max_bytes_to_receive, int* rece
 #ifdef ODRIVE_INCLUDE_UART
 	if (uart_file != -1)
 	{
-		std::vector<u8> stream(max_bytes_to_receive);
 		*received_bytes = 0;
 		u32_micros start_time = time_micros();
 		int timeouts = 0;
-		while (true)
+		// The response might already be in the buffer, if it was read together with the previous one.
+		while (!parse_uart_frame(packet, max_bytes_to_receive, received_bytes))
 		{
-			if (time_micros() - start_time > (expected_length == 64 ? 2000 : 800))
+			u32_micros elapsed = time_micros() - start_time;
+			if (elapsed > timeout)
 			{
 				//printf("recv timeout!\n");
 				return false;
 			}
+			if (!uart_wait_readable(uart_file, timeout - elapsed))
+			{
+				timeouts++;
+				continue;
+			}
 
-			int received = read(uart_file, stream.data()+*received_bytes, max_bytes_to_receive-*received_bytes);
-			//printf("recv: %d %d\n", max_bytes_to_receive, *received_bytes);
+			int received = read(uart_file, uart_rx_buffer+uart_rx_length, sizeof(uart_rx_buffer)-uart_rx_length);
+			//printf("recv: %d %d\n", max_bytes_to_receive, received);
 			if (received == 0)
 			{
 				timeouts++;
@@ -833,39 +1549,390 @@ bool ODrive::receive_from_odrive(u8* packet, int max_bytes_to_receive, int* rece
 			if (received < 0)
 			{
 				communication_error = true;
-				printf("recv return: %d\n", *received_bytes);
+				printf("recv return: %d\n", received);
 				*received_bytes = 0;
 				return true;
 			}
-			*received_bytes += received;
-			if (*received_bytes < 5)
-			{
-				//printf("recv again %d\n", *received_bytes);
+			uart_rx_length += received;
+		}
+		/*if (timeouts)
+		{
+			printf("timeout: %dus. timeouts: %d. time: %dus\n", timeout, timeouts, (int)((time_micros() - start_time)));
+		}*/
+	}
+#endif
+	return true;
+}
+
+void ODrive::set_ascii_setpoint(char command, int axis, float value, WriteTiming* timing)
+{
+	std::unique_lock<std::mutex> lock(mutex);
+	CallerState& state = caller();
+	if (communication_error)
+		return;
+	if (!ascii_protocol)
+	{
+		communication_error = true;
+		printf("set_ascii_setpoint() needs the ASCII protocol\n");
+		return;
+	}
+	endpoint_request_counter++;
+	Request r;
+	r.seq_no = 0;
+	r.endpoint_id = -1;
+	r.length = 0;
+	r.length_must_match = false;
+	r.sent = false;
+	r.done = false;
+	int length = snprintf((char*)r.packet.data(), max_packet_size, "%c %d %.9g", command, axis, value);
+	r.packet.resize(std::min(length, max_packet_size-1));
+	r.value = timing;
+	r.on_response = timing ? &on_write_timing : nullptr;
+	r.resent = false;
+	r.reads_value = false;
+	r.number = endpoint_request_counter;
+	r.ascii_feedback = false;
+	r.call_function = -1;
+	state.requests.push_back(std::move(r));
+	bool flush = state.pipeline_depth == 0;
+	lock.unlock();
+	if (flush)
+		flush_requests();
+}
+
+// Formats a value in the wire format of fibre as text.
+static void format_ascii_value(EndpointType type, const u8* payload, char* text, int max_length)
+{
+	u64 bits = 0;
+	int size = endpoint_type_size(type);
+	for (int i = 0; i < size; i++)
+		bits |= (u64)payload[i] << (8*i);
+	switch (type)
+	{
+	case EndpointType::float32:
+	{
+		float value;
+		u32 bits32 = (u32)bits;
+		memcpy(&value, &bits32, sizeof(value));
+		snprintf(text, max_length, "%.9g", value);
+		break;
+	}
+	case EndpointType::int8:  snprintf(text, max_length, "%d", (int)(s8)bits); break;
+	case EndpointType::int16: snprintf(text, max_length, "%d", (int)(s16)bits); break;
+	case EndpointType::int32: snprintf(text, max_length, "%d", (int)(s32)bits); break;
+	case EndpointType::int64: snprintf(text, max_length, "%lld", (long long)(s64)bits); break;
+	default: snprintf(text, max_length, "%llu", (unsigned long long)bits); break;
+	}
+}
+
+bool ODrive::ascii_request_line(const Request& r, char* line, int max_length, bool* has_response)
+{
+	*has_response = false;
+	if (r.endpoint_id == -1)
+	{
+		// set_ascii_setpoint() already made the line.
+		snprintf(line, max_length, "%.*s", r.packet.size(), (const char*)r.packet.data());
+		return true;
+	}
+	const Endpoint* endpoint = endpoint_by_id(r.endpoint_id & 0x7fff);
+	if (!endpoint)
+		return false;
+	const char* path = endpoint->name[0] == '.' ? endpoint->name+1 : endpoint->name;
+	if (endpoint->type_enum == EndpointType::function)
+	{
+		// Only the functions without parameters that have their own command.
+		int axis;
+		const char* name = endpoint->short_name;
+		bool is_root = strcmp(path, name) == 0;
+		if (strcmp(name, "watchdog_feed") == 0 && sscanf(path, "axis%d.", &axis) == 1)
+			snprintf(line, max_length, "u %d", axis);
+		else if (is_root && strcmp(name, "save_configuration") == 0)
+			snprintf(line, max_length, "ss");
+		else if (is_root && strcmp(name, "erase_configuration") == 0)
+			snprintf(line, max_length, "se");
+		else if (is_root && strcmp(name, "reboot") == 0)
+			snprintf(line, max_length, "sr");
+		else if (is_root && strcmp(name, "clear_errors") == 0)
+			snprintf(line, max_length, "sc");
+		else
+			return false;
+		return true;
+	}
+	if (endpoint_type_size(endpoint->type_enum) == 0)
+		return false;
+
+	// The fibre packet is seq_no, endpoint id, response size, payload and the trailer.
+	const u8* payload = r.packet.data()+6;
+	int payload_length = r.packet.size()-8;
+	if (r.ascii_feedback)
+	{
+		for (size_t a = 0; a < ascii_feedback_ids.size(); a++)
+		{
+			if (ascii_feedback_ids[a].pos_estimate == endpoint->id)
+				snprintf(line, max_length, "f %d", (int)a);
+		}
+		*has_response = true;
+	}
+	else if (payload_length == 0)
+	{
+		snprintf(line, max_length, "r %s", path);
+		*has_response = true;
+	}
+	else if (payload_length == endpoint_type_size(endpoint->type_enum))
+	{
+		char value[32];
+		format_ascii_value(endpoint->type_enum, payload, value, sizeof(value));
+		snprintf(line, max_length, "w %s %s", path, value);
+	}
+	else
+		return false;
+	return true;
+}
+
+bool ODrive::ascii_response(Request& r, const char* text, char** end)
+{
+	const Endpoint* endpoint = endpoint_by_id(r.endpoint_id & 0x7fff);
+	if (!endpoint)
+		return false;
+	while (*text == ' ')
+		text++;
+	// Converted to the wire format of fibre, so the response handlers and shadow values work as usual.
+	serial_buffer payload;
+	switch (endpoint->type_enum)
+	{
+	case EndpointType::float32:
+		serialize(payload, (float)strtod(text, end));
+		break;
+	case EndpointType::boolean:
+		if (*text == 'T' || *text == 't' || *text == 'F' || *text == 'f')
+		{
+			serialize(payload, *text == 'T' || *text == 't');
+			*end = (char*)text+1;
+			while (**end >= 'a' && **end <= 'z')
+				(*end)++;
+		}
+		else
+			serialize(payload, strtol(text, end, 10) != 0);
+		break;
+	case EndpointType::uint8:  serialize(payload, (u8)strtoul(text, end, 10)); break;
+	case EndpointType::int8:   serialize(payload, (s8)strtol(text, end, 10)); break;
+	case EndpointType::uint16: serialize(payload, (u16)strtoul(text, end, 10)); break;
+	case EndpointType::int16:  serialize(payload, (s16)strtol(text, end, 10)); break;
+	case EndpointType::uint32: serialize(payload, (s32)strtoul(text, end, 10)); break;
+	case EndpointType::int32:  serialize(payload, (s32)strtol(text, end, 10)); break;
+	case EndpointType::uint64: serialize(payload, (s64)strtoull(text, end, 10)); break;
+	case EndpointType::int64:  serialize(payload, (s64)strtoll(text, end, 10)); break;
+	default: return false;
+	}
+	// Errors like "invalid property" don't start with a number.
+	if (*end == text)
+		return false;
+	if (r.on_response)
+		r.on_response(this, r.value, payload.data(), payload.size());
+	if (r.reads_value && is_shadowed(endpoint->id))
+		shadow_read(endpoint->id, payload.data(), payload.size(), r.number);
+	return true;
+}
+
+#ifdef ODRIVE_INCLUDE_UART
+// Takes the next line out of uart_rx_buffer, without the newline. Like with parse_uart_frame(),
+// the bytes after it are kept for the next call.
+bool ODrive::receive_ascii_line(char* line, int max_length, u32_micros timeout)
+{
+	u32_micros start_time = time_micros();
+	for (;;)
+	{
+		u8* newline = (u8*)memchr(uart_rx_buffer, '\n', uart_rx_length);
+		if (newline)
+		{
+			int consumed = (int)(newline-uart_rx_buffer)+1;
+			int length = consumed-1;
+			if (length > 0 && uart_rx_buffer[length-1] == '\r')
+				length--;
+			length = std::min(length, max_length-1);
+			memcpy(line, uart_rx_buffer, length);
+			line[length] = 0;
+			memmove(uart_rx_buffer, uart_rx_buffer+consumed, uart_rx_length-consumed);
+			uart_rx_length -= consumed;
+			if (length == 0)
 				continue;
+			return true;
+		}
+		if (uart_rx_length == (int)sizeof(uart_rx_buffer))
+		{
+			// No response is that long, so this is garbage.
+			count_link_event(&LinkStats::resyncs);
+			uart_rx_length = 0;
+		}
+		u32_micros elapsed = time_micros() - start_time;
+		if (elapsed > timeout)
+			return false;
+		// This also returns early if a signal interrupts it.
+		if (!uart_wait_readable(uart_file, timeout - elapsed))
+			continue;
+		int received = read(uart_file, uart_rx_buffer+uart_rx_length, sizeof(uart_rx_buffer)-uart_rx_length);
+		if (received < 0)
+		{
+			communication_error = true;
+			printf("recv return: %d\n", received);
+			return false;
+		}
+		uart_rx_length += received;
+	}
+}
+
+bool ODrive::flush_ascii_requests(std::unique_lock<std::mutex>& lock, CallerState& state)
+{
+	// Like flush_requests(), the commands are sent back to back. Only "r" and "f" have a response
+	// and those come in the order of the commands, so the next line belongs to the oldest
+	// request that isn't done. That's why one thread at a time has the link for its whole batch.
+	// It is marked by receiving, like in flush_requests(), and mutex isn't held while the thread
+	// writes or waits for a line.
+	std::vector<Request>& requests = state.requests;
+	u32_micros start_time = time_micros();
+	if (!state.background)
+		foreground_unsent += (int)requests.size();
+	while ((receiving || (state.background && foreground_unsent > 0)) && !communication_error)
+	{
+		u32_micros elapsed = time_micros() - start_time;
+		if (elapsed > request_timeout)
+		{
+			communication_error = true;
+			printf("endpoint request timeout\n");
+			break;
+		}
+		receive_cv.wait_for(lock, std::chrono::microseconds(request_timeout - elapsed));
+	}
+	if (!state.background)
+	{
+		foreground_unsent -= (int)requests.size();
+		receive_cv.notify_all();
+	}
+	if (communication_error)
+	{
+		requests.clear();
+		invalidate_shadow_locked();
+		return false;
+	}
+	receiving = true;
+
+	for (size_t i = 0; i+1 < requests.size(); i++)
+	{
+		const Request& pos = requests[i];
+		const Request& vel = requests[i+1];
+		if (!pos.reads_value || !vel.reads_value)
+			continue;
+		for (const AsciiFeedbackIds& ids : ascii_feedback_ids)
+		{
+			if ((pos.endpoint_id & 0x7fff) == ids.pos_estimate && (vel.endpoint_id & 0x7fff) == ids.vel_estimate)
+			{
+				requests[i].ascii_feedback = true;
+				i++;
+				break;
 			}
-			if (*received_bytes-5 < stream[1])
+		}
+	}
+
+	char line[128];
+	size_t num_sent = 0, num_done = 0;
+	int in_flight = 0;
+	u64_micros transferred_time = 0; // when the UART will be done with the lines written so far
+	while (num_done < requests.size() && !communication_error)
+	{
+		while (num_sent < requests.size() && in_flight < max_requests_in_flight)
+		{
+			Request& r = requests[num_sent];
+			bool has_response;
+			if (!ascii_request_line(r, line, sizeof(line)-1, &has_response))
 			{
-				//printf("recv again %d < %d\n", *received_bytes-5, stream[1]);
-				continue;
+				const Endpoint* endpoint = endpoint_by_id(r.endpoint_id & 0x7fff);
+				printf("%s cannot be used with the ASCII protocol\n", endpoint ? endpoint->name : "?");
+				communication_error = true;
+				break;
+			}
+			int length = (int)strlen(line);
+			line[length++] = '\n';
+			lock.unlock();
+			int sent_bytes = (int)write(uart_file, line, length);
+			lock.lock();
+			if (sent_bytes != length)
+			{
+				communication_error = true;
+				printf("send return %d\n", sent_bytes);
+				break;
 			}
+			r.sent = true;
+			r.done = !has_response;
+			transferred_time = std::max(transferred_time, time_micros_64()) + (u64_micros)(length * uart_byte_time);
+			// Timed writes have no response, they arrive when their line is transferred.
+			if (!has_response && r.on_response == &on_write_timing)
+				((WriteTiming*)r.value)->record(transferred_time);
+			if (r.endpoint_id != -1 && collect_stats)
+			{
+				r.send_time = time_micros_64();
+				stats_for(r.endpoint_id).bytes_sent += length;
+			}
+			num_sent++;
+			if (r.ascii_feedback)
+				requests[num_sent++].sent = true;
+			if (has_response)
+				in_flight++;
+		}
+		while (num_done < num_sent && requests[num_done].done)
+			num_done++;
+		if (num_done == requests.size() || communication_error)
+			break;
+
+		Request& r = requests[num_done];
+		u32_micros elapsed = time_micros() - start_time;
+		lock.unlock();
+		bool received = elapsed <= request_timeout && receive_ascii_line(line, sizeof(line), request_timeout - elapsed);
+		lock.lock();
+		if (!received)
+		{
+			// Without sequence numbers we can't tell a late response from the next one, so
+			// there is no resending.
+			count_link_event(&LinkStats::timeouts);
+			if (collect_stats)
+				stats_for(r.endpoint_id).timeouts++;
+			communication_error = true;
+			printf("endpoint request timeout\n");
 			break;
 		}
-		stream.resize(*received_bytes);
-		*received_bytes = stream_to_packet(stream, packet, max_bytes_to_receive);
-		if (*received_bytes < 0)
+		char* end = line;
+		bool ok = ascii_response(r, line, &end);
+		if (ok && r.ascii_feedback)
+			ok = ascii_response(requests[num_done+1], end, &end);
+		if (!ok)
 		{
-			//communication_error = true;
-			*received_bytes = 0;
-			return false;
+			const Endpoint* endpoint = endpoint_by_id(r.endpoint_id & 0x7fff);
+			printf("%s: unexpected response: %s\n", endpoint ? endpoint->name : "?", line);
+			communication_error = true;
+			break;
 		}
-		/*if (timeouts)
+		if (collect_stats)
 		{
-			printf("expectedlength: %d. timeouts: %d. time: %dus\n", expected_length, timeouts, (int)((time_micros() - start_time)));
-		}*/
+			EndpointStats& stats = stats_for(r.endpoint_id);
+			u64_micros now = time_micros_64();
+			stats.requests++;
+			stats.bytes_received += (u32)strlen(line)+1;
+			stats.last_latency = (u32_micros)(now - r.send_time);
+			stats.last_response_time = now;
+			stats.latency.record(stats.last_latency);
+		}
+		r.done = true;
+		if (r.ascii_feedback)
+			requests[num_done+1].done = true;
+		in_flight--;
 	}
-#endif
-	return true;
+	receiving = false;
+	receive_cv.notify_all();
+	requests.clear();
+	if (communication_error)
+		invalidate_shadow_locked();
+	return !communication_error;
 }
+#endif
 
 void ODrive::serialize(serial_buffer& serial_buffer, const s64& value) {
 	serial_buffer.push_back((value >> 0) & 0xFF);
@@ -885,6 +1952,14 @@ void ODrive::serialize(serial_buffer& serial_buffer, const s32& value) {
 	serial_buffer.push_back((value >> 24) & 0xFF);
 }
 
+void ODrive::serialize(serial_buffer& serial_buffer, const u32& value) {
+	serialize(serial_buffer, (s32)value);
+}
+
+void ODrive::serialize(serial_buffer& serial_buffer, const u64& value) {
+	serialize(serial_buffer, (s64)value);
+}
+
 void ODrive::serialize(serial_buffer& serial_buffer, const float& valuef) {
 	union {
 		float f;
@@ -986,7 +2061,6 @@ void ODrive::deserialize(serial_buffer_iterator& it, u8& value) {
 serial_buffer ODrive::create_odrive_packet(u16 seq_no, int endpoint, u16 response_size, const serial_buffer& payload)
 {
 	serial_buffer data;
-	data.reserve(8+payload.size());
 	serialize(data, (u16)seq_no);
 	serialize(data, (u16)endpoint);
 	serialize(data, (u16)response_size);
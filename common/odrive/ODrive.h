@@ -19,6 +19,12 @@
 // float motor0_position;
 // axis0("controller")("input_pos").get(motor0_position); // This gets the 'input_pos' paramater of the first axis from the ODrive
 // axis0("controller")("input_pos").set(20.0f); // This sets the 'input_pos' paramater of the first axis
+// EndpointHandle pos_estimate = axis0("encoder")("pos_estimate").handle(); // Resolve endpoints that are used often only once
+// pos_estimate.get(motor0_position); // This doesn't do any string lookups
+//
+// With several ODrives on USB, pick one by its serial number:
+// for (const ODriveUsbInfo& info : ODrive::enumerate_usb()) printf("%s\n", info.serial.c_str());
+// odrive.connect_usb("2087399B4D4D");
 
 // The original code is from: https://github.com/tokol0sh/Odrive_USB
 // and was modified to also handle UART, be more reliable, handle function calls
@@ -29,9 +35,17 @@
 
 #pragma once
 #include "endpoint.h"
+#include "endpoint_stats.h"
 #include <string>
 #include <iostream>
 #include <vector>
+#include <type_traits>
+#include <algorithm>
+#include <map>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <thread>
 
 // If you don't need USB or UART support, you can adjust these defines.
 // Right now UART won't work on Windows.
@@ -40,39 +54,253 @@
 #define ODRIVE_INCLUDE_UART
 #endif
 
+class ODriveSim;
+
 #ifdef ODRIVE_INCLUDE_USB
 struct libusb_context;
 struct libusb_device_handle;
+class UsbAsyncTransport;
 #endif
 
-typedef std::vector<u8> serial_buffer;
+// Packets are at most 64 bytes long (the size of a USB bulk packet), the stream framing for UART
+// adds 5 bytes to that. So all buffers for sending and receiving have a fixed capacity and
+// no heap allocations are needed for a request.
+const int max_packet_size = 64;
+const int max_stream_packet_size = max_packet_size+5;
+
+template<int capacity>
+struct FixedBuffer
+{
+	u8 bytes[capacity];
+	int length = 0;
+
+	u8* data() { return bytes; }
+	const u8* data() const { return bytes; }
+	int size() const { return length; }
+	void clear() { length = 0; }
+	void resize(int new_length)
+	{
+		assert(new_length >= 0 && new_length <= capacity);
+		length = new_length;
+	}
+	void push_back(u8 value)
+	{
+		assert(length < capacity);
+		if (length < capacity)
+			bytes[length++] = value;
+	}
+	u8& operator[](int i) { return bytes[i]; }
+	u8 operator[](int i) const { return bytes[i]; }
+	const u8* begin() const { return bytes; }
+	const u8* end() const { return bytes+length; }
+};
+
+typedef FixedBuffer<max_packet_size> serial_buffer;
+typedef FixedBuffer<max_stream_packet_size> stream_buffer;
 typedef u8* serial_buffer_iterator;
-//typedef serial_buffer::iterator serial_buffer_iterator;
 
 inline serial_buffer_iterator get_it(serial_buffer& buf)
 {
 	return buf.data();
 }
 
+// When the writes of a burst arrived at ODrive, see ODrive::set_synchronized(). With fibre that
+// is when their acknowledgement was received. The ASCII protocol has none, there it is when
+// their line was transferred completely.
+struct WriteTiming
+{
+	int writes = 0;
+	u64_micros first = 0, last = 0;
+
+	void record(u64_micros time)
+	{
+		first = writes ? std::min(first, time) : time;
+		last = writes ? std::max(last, time) : time;
+		writes++;
+	}
+	// How far apart ODrive applied the writes.
+	u32_micros skew() const { return writes > 1 ? (u32_micros)(last - first) : 0; }
+};
+
+// Everything that went wrong on the link to ODrive, counted since connecting. Unlike the statistics per endpoint, these are always counted. The difference of
+// two copies is what happened in between, e.g. in one frame.
+struct LinkStats
+{
+	u32 crc_errors = 0; // UART frames with a valid header whose crc16 didn't match
+	u32 resyncs = 0; // how often bytes had to be skipped to find the next UART frame or line
+	u32 unexpected_responses = 0; // responses whose sequence number no request was waiting for
+	u32 timeouts = 0; // no response in time. With fibre the requests are sent again, with ASCII that's an error.
+	u32 resends = 0; // requests that were sent again
+
+	LinkStats operator-(const LinkStats& o) const
+	{
+		LinkStats d;
+		d.crc_errors = crc_errors - o.crc_errors;
+		d.resyncs = resyncs - o.resyncs;
+		d.unexpected_responses = unexpected_responses - o.unexpected_responses;
+		d.timeouts = timeouts - o.timeouts;
+		d.resends = resends - o.resends;
+		return d;
+	}
+};
+
+// An ODrive found by ODrive::enumerate_usb()
+struct ODriveUsbInfo
+{
+	std::string serial; // empty if the device couldn't be opened
+	int bus = 0, address = 0;
+	int usb_interface = -1, write_endpoint = -1, read_endpoint = -1;
+};
+
 class ODrive
 {
 public:
 	bool connect_uart(const char* uart_address, int baud_rate, bool stop_bits_2);
+	// Connects via UART to an ODrive that uses the ASCII protocol on it. The json interface can't
+	// be downloaded that way, so it is loaded from json_filename, for example the file a USB
+	// connection to the same firmware saved in json_cache_folder.
+	// get/set/call work as with fibre: reads are sent as "r", writes as "w" (not acknowledged)
+	// and the functions the ASCII protocol has a command for as that command. Reads of
+	// pos_estimate and then vel_estimate of one axis are combined into one "f" command. Other
+	// function calls are a communication error. There are no sequence numbers, so lost responses
+	// can't be requested again and are a communication error too.
+	bool connect_uart_ascii(const char* uart_address, int baud_rate, bool stop_bits_2, const char* json_filename);
+	bool is_ascii() const { return ascii_protocol; }
+	// Queues the streaming setpoint command 'p', 'v' or 'c' of the ASCII protocol. It sets
+	// input_pos, input_vel or input_torque of the axis, switches the control mode to match and
+	// feeds the watchdog. There is no response, so this costs no round trip. ASCII only.
+	// If timing is given, the arrival of the command is recorded there like set_synchronized()
+	// does. Reset it before the first command of a burst.
+	void set_ascii_setpoint(char command, int axis, float value, WriteTiming* timing = nullptr);
 
-	// Right know we assume that there is at most one ODrive connected via USB, so there
-	// is no parameter to specify which ODrive to connect to yet.
-	bool connect_usb();
+	// Connects to the ODrive with the given serial number (as shown by enumerate_usb()), or to the
+	// first one found if serial is null. Every instance has its own libusb context, so several
+	// ODrives can be used at the same time from different threads, one thread per instance.
+	bool connect_usb(const char* serial = nullptr);
+	// Connects to a simulated ODrive in the same process (see odrive_sim.h). sim has to stay
+	// valid until close() is called.
+	bool connect_sim(ODriveSim* sim);
 	void close();
 
+	// Lists all ODrives that are connected via USB.
+	static std::vector<ODriveUsbInfo> enumerate_usb();
+
+	// Pipelined requests:
+	// Normally every get/set waits for the response of ODrive before it returns. Between
+	// pipeline_begin() and pipeline_end(), get/set calls are only queued. pipeline_end() then
+	// sends them back to back and collects all the responses, so the whole batch costs roughly
+	// one round trip instead of one per value.
+	// Values passed to get() must stay valid until pipeline_end() returns and get2() cannot be
+	// used in between. Calls can be nested, only the outermost pipeline_end() sends the requests.
+	// Function calls are queued too, their return values are valid after pipeline_end().
+	// The requests of a thread take effect in the order they were queued, also when they have to
+	// be sent again: A request isn't sent while an earlier one to the same endpoint is unanswered,
+	// unless both are reads. So a read after a write waits one round trip for it. A function call
+	// with arguments takes up to three round trips: the inputs, the call and the outputs are sent
+	// one after the other, and calls of the same function don't overlap. There is no order
+	// between the requests of different threads.
+	void pipeline_begin();
+	bool pipeline_end(); // returns false on communication error
+	// Used by Endpoint::call() around the requests of one call, like pipeline_begin()/end().
+	void call_begin(int function_id);
+	bool call_end();
+
+	// Synchronized writes: The float values are queued back to back, so they reach ODrive in one
+	// burst, like the setpoints of several axes that move together. Queue them before the reads of
+	// the same pipeline, otherwise the reads are sent in between. timing is reset here and holds
+	// when the writes arrived once the pipeline has ended. Writes skipped because of shadow
+	// values are not recorded.
+	void set_synchronized(const EndpointHandle* handles, const float* values, int count, WriteTiming* timing);
+
+	// Threads: Once connected, get/set/call and the pipelines can be used from several threads at
+	// the same time. Every thread has its own pipeline. Their requests share the link and are
+	// matched by sequence number, so a thread with a few requests doesn't wait until another
+	// thread's long batch is done, only for a free slot in max_requests_in_flight. One thread at
+	// a time receives and hands the responses to the threads they belong to.
+	// A communication error is one of the link, so it fails the requests of all threads.
+	// With the ASCII protocol, the requests of the threads are sent one batch after the other.
+	// connect, close and the settings below must not be changed while requests are running.
+
+	// Marks the calling thread as background thread, like the one of ODrivePoller. It doesn't send
+	// while other threads have requests waiting to be sent and it only uses half of
+	// max_requests_in_flight, so the requests of the control loop don't wait behind it.
+	// Call this after connecting.
+	void set_background_thread();
+	// The pipeline of a thread is kept until close(). A thread that ends before, like the one of
+	// ODrivePoller, calls this last, so threads that come and go don't pile up.
+	void end_thread();
+
 public:
 	Endpoint root;
 	bool is_connected = false;
-	bool communication_error = false;
+	std::atomic<bool> communication_error{false};
 	int endpoint_request_counter = 0;
+	int max_requests_in_flight = 8; // How many requests are sent before we wait for a response
+
+	// Lost responses are detected by a timeout. Like in TCP (RFC 6298), the time until a response
+	// arrives is smoothed and the timeout is srtt + 4*rttvar, clamped to these bounds. On UART the
+	// time to transmit the response is added, which depends on its length and the baud rate. With
+	// USB it is rounded up to milliseconds, because libusb can't wait shorter. After a timeout the
+	// next one is twice as long. Sends that take longer than request_timeout are a communication
+	// error.
+	u32_micros min_retransmit_timeout = 500;
+	u32_micros max_retransmit_timeout = 100000;
+	// flush_requests() gives up and sets communication_error if the requests take longer than this.
+	u32_micros request_timeout = 1000000;
+	LinkStats get_link_stats() const;
+
+	// If this is set, the json interface is saved in this folder after it is downloaded. On the next
+	// connect it is loaded from there instead, as long as ODrive reports the same json crc.
+	// With json_cache_refresh the cached file is ignored and downloaded again.
+	std::string json_cache_folder;
+	bool json_cache_refresh = false;
+
+	// Use the asynchronous libusb transport (usb_async.h) instead of blocking bulk transfers.
+	// Needs to be set before connect_usb().
+	bool usb_async = false;
 	
 	ODriveVersion odrive_fw_version;
 	bool odrive_fw_is_milana;
 
+	// Statistics per endpoint id (see endpoint_stats.h). They are only collected while
+	// collect_stats is set, because that needs the time for every request and response.
+	bool collect_stats = false;
+	const std::vector<EndpointStats>& get_endpoint_stats() const { return endpoint_stats; } // indexed by endpoint id
+	u32 unmatched_responses = 0; // responses that didn't belong to any request
+	void reset_stats();
+	// Prints the n endpoints with the highest 99th percentile latency. If since is set, only
+	// endpoints that received a response after that time are printed, sorted by their last
+	// latency. That shows which requests made a single slow frame slow.
+	void print_slowest_endpoints(int n, u64_micros since = 0) const;
+
+	// The endpoint with that id, or nullptr. Its name is the full path.
+	const Endpoint* endpoint_by_id(int endpoint_id) const;
+
+	// Shadow values: For endpoints where this is enabled, the last value that was written or read
+	// is remembered and set() skips writes of the same value. That is only correct as long as
+	// nothing else changes the endpoint. If ODrive may have changed it itself (after a reboot,
+	// an error, a calibration or a state change), call invalidate_shadow(). All shadow values are
+	// dropped on communication errors and on close().
+	// Enabling an endpoint with children enables all of its descendants.
+	void enable_shadow(const Endpoint& endpoint);
+	void invalidate_shadow(); // all endpoints
+	void invalidate_shadow(const EndpointHandle& handle);
+	u32 shadow_skipped_writes = 0;
+
+	// The crc of the json interface. All firmwares with the same crc have the same endpoint ids,
+	// so code generated by endpoint_codegen (see typed_endpoint.h) uses its ids directly if
+	// this matches.
+	u32 get_json_crc() const { return json_crc; }
+
+	// UART framing: 0xAA, length, crc8, packet, crc16. stream_to_packet() returns the packet
+	// length or -1 if the frame is invalid. find_stream_packet() searches a byte stream for the
+	// next valid frame. Also used by the UART emulator.
+	static stream_buffer packet_to_stream(const serial_buffer& packet);
+	static int stream_to_packet(const u8* stream, int stream_length, u8* packet, int max_length);
+	// If crc_errors is given, the frames that were skipped because of their crc16 are added to it.
+	static bool find_stream_packet(const u8* stream, int stream_length, u8* packet, int max_length, int* packet_length, int* consumed, bool* skipped,
+		u32* crc_errors = nullptr);
+
 public:
 	// The following functions shouldn't be used directly. They are only public
 	// because the Endpoint class needs them.
@@ -80,30 +308,31 @@ public:
 	void endpoint_request(int endpoint_id, serial_buffer& received_payload, const serial_buffer& payload, bool ack, int length, bool length_must_match=true);
 
 	void call(int id);
-	void call(int id, int in1, float* out1);
-	void call(int id, int in1, u64* out1);
-	void call(int id, bool* out1);
+
+	// Used by TypedEndpoint if the json crc doesn't match. The endpoint is looked up by path once
+	// and cached by the id it had in the generated header.
+	EndpointHandle typed_fallback_handle(int generated_id, const char* path);
 	
 	template<typename T>
 	void set_value(int id, const T& value)
 	{
 		serial_buffer send_payload;
-		send_payload.reserve(sizeof(T));
-		serial_buffer receive_payload;
 		serialize(send_payload, value);
-		endpoint_request(id, receive_payload, send_payload, false, sizeof(T));
+		if (queue_request(id, send_payload, sizeof(T), true, nullptr, nullptr))
+			flush_requests();
 	}
 	template<typename T>
 	void get_value(int id, T& value)
+	{
+		get_value_as<T>(id, value);
+	}
+	// Reads a value that is transmitted as type Wire and converts it to T.
+	template<typename Wire, typename T>
+	void get_value_as(int id, T& value)
 	{
 		serial_buffer send_payload;
-		serial_buffer receive_payload;
-		endpoint_request(id, receive_payload, send_payload, true, sizeof(T));
-		if (receive_payload.size() == sizeof(T))
-		{
-			auto it = get_it(receive_payload);
-			deserialize(it, value);
-		}
+		if (queue_request(id, send_payload, sizeof(Wire), true, &value, &on_value_response<Wire, T>))
+			flush_requests();
 	}
 
 private:
@@ -114,18 +343,156 @@ private:
 	libusb_device_handle* usb_device = nullptr;
 	int usb_interface;
 	int usb_write_endpoint = -1, usb_read_endpoint = -1;
+	UsbAsyncTransport* usb_transport = nullptr;
 #endif
+	ODriveSim* sim = nullptr;
 #ifdef ODRIVE_INCLUDE_UART
+	bool open_uart(const char* uart_address, int baud_rate, bool stop_bits_2);
+	bool receive_ascii_line(char* line, int max_length, u32_micros timeout);
 	int uart_file = -1;
+	// Bytes read from the UART that haven't been parsed yet. Reads aren't limited to one frame,
+	// so this can hold the start of the next response when requests are pipelined.
+	u8 uart_rx_buffer[4*max_stream_packet_size];
+	int uart_rx_length = 0;
+	bool parse_uart_frame(u8* packet, int max_length, int* packet_length);
 #endif
 
 	u16 firmware_crc = 0;
+	u32 json_crc = 0;
 	u16 seq_no = 0;
 
+	// This is called with the payload of the response, after its length has been checked.
+	typedef void (*ResponseHandler)(ODrive* odrive, void* value, const u8* payload, int length);
+
+	// A request that is queued or sent to ODrive, but whose response has not been received yet.
+	// The responses are matched to the requests by sequence number.
+	struct Request
+	{
+		u16 seq_no;
+		int endpoint_id;
+		int length; // expected response length
+		bool length_must_match;
+		bool sent;
+		bool done;
+		serial_buffer packet;
+		void* value;
+		ResponseHandler on_response;
+		u64_micros send_time; // first send
+		u64_micros last_send_time; // the receive timeout runs from here
+		bool resent;
+		bool reads_value; // no payload, so the response is the current value
+		int number; // endpoint_request_counter when it was queued
+		// ASCII protocol: this and the next request are answered by one "f" command.
+		bool ascii_feedback;
+		int call_function; // the function of the Endpoint::call() it belongs to, or -1
+	};
+	// The requests a thread has queued. std::map doesn't move its elements, so the requests
+	// can be referenced from requests_in_flight while the map changes.
+	struct CallerState
+	{
+		std::vector<Request> requests;
+		int pipeline_depth = 0;
+		bool background = false;
+		int call_function = -1; // during Endpoint::call()
+	};
+	std::map<std::thread::id, CallerState> callers;
+	CallerState& caller(); // of the calling thread
+
+	// mutex protects everything that is shared by the threads: callers, requests_in_flight,
+	// seq_no, the shadow values, the statistics and the retransmit timeout. It is not held while
+	// receiving. With the simulator, sim_mutex serializes the access to it.
+	mutable std::mutex mutex;
+	std::mutex sim_mutex;
+	std::condition_variable receive_cv; // notified when a thread stops receiving
+	bool receiving = false; // a thread is waiting for a response
+	int foreground_unsent = 0; // requests of threads that aren't background threads, not sent yet
+	std::vector<Request*> requests_in_flight; // of all threads, in the order they were sent
+	// The last completed requests, for the statistics of responses that arrive twice.
+	struct CompletedRequest
+	{
+		u16 seq_no;
+		int endpoint_id;
+	};
+	static const int num_completed_requests = 32;
+	CompletedRequest completed_requests[num_completed_requests] = {};
+	int completed_index = 0;
+
+	std::vector<EndpointStats> endpoint_stats;
+	// The UART receive functions count without mutex, which may already be held by the ASCII
+	// protocol, so the link stats have their own.
+	LinkStats link_stats;
+	mutable std::mutex link_stats_mutex;
+	void count_link_event(u32 LinkStats::*counter, u32 count = 1);
+	EndpointTable endpoint_table;
+	std::vector<const Endpoint*> endpoints_by_id;
+	std::vector<EndpointHandle> typed_fallback_handles; // indexed by the generated id
+
+	struct ShadowValue
+	{
+		bool enabled = false;
+		bool valid = false;
+		u8 size = 0;
+		u8 bytes[8];
+		int last_write = 0; // number of the last write request, older reads are ignored
+	};
+	std::vector<ShadowValue> shadow_values; // indexed by endpoint id
+	bool is_shadowed(int endpoint_id) const
+	{
+		return endpoint_id < (int)shadow_values.size() && shadow_values[endpoint_id].enabled;
+	}
+	void shadow_write(int endpoint_id, const serial_buffer& payload, int number);
+	void shadow_read(int endpoint_id, const u8* payload, int length, int number);
+	void enable_shadow_locked(const Endpoint& endpoint);
+	void invalidate_shadow_locked();
+	EndpointStats& stats_for(int endpoint_id);
+
+	template<typename Wire, typename T>
+	static void on_value_response(ODrive* odrive, void* value, const u8* payload, int length)
+	{
+		Wire v;
+		serial_buffer_iterator it = (serial_buffer_iterator)payload;
+		odrive->deserialize(it, v);
+		*(T*)value = (T)v;
+	}
+	static void on_raw_response(ODrive* odrive, void* value, const u8* payload, int length);
+	static void on_write_timing(ODrive* odrive, void* value, const u8* payload, int length);
+
+	// Returns true if the request has to be sent right away, because the calling thread is not
+	// in a pipeline.
+	bool queue_request(int endpoint_id, const serial_buffer& payload, int length, bool length_must_match,
+			void* value, ResponseHandler on_response);
+	bool flush_requests();
+	bool must_wait(const std::vector<Request>& requests, size_t num_done, size_t index) const;
+
+	// ASCII protocol. Requests are queued as fibre packets like always and only translated to
+	// text lines in flush_ascii_requests(). Requests with endpoint id -1 hold a complete line.
+	bool ascii_protocol = false;
+	struct AsciiFeedbackIds
+	{
+		int pos_estimate = -1, vel_estimate = -1;
+	};
+	std::vector<AsciiFeedbackIds> ascii_feedback_ids; // indexed by axis
+	bool ascii_request_line(const Request& r, char* line, int max_length, bool* has_response);
+	bool ascii_response(Request& r, const char* text, char** end);
+#ifdef ODRIVE_INCLUDE_UART
+	bool flush_ascii_requests(std::unique_lock<std::mutex>& lock, CallerState& state);
+#endif
+
 private:
 	bool get_json_interface();
-	void send_to_odrive(std::vector<u8>& packet);
-	bool receive_from_odrive(u8* packet, int max_bytes_to_receive, int* received_bytes, int expected_length);
+	bool init_endpoints(); // after the endpoint table is parsed
+	bool download_json_interface(std::vector<u8>& received_json);
+	void send_to_odrive(const serial_buffer& packet);
+	bool receive_from_odrive(u8* packet, int max_bytes_to_receive, int* received_bytes, u32_micros timeout);
+
+	static const u32_micros initial_retransmit_timeout = 2000;
+	bool rtt_measured = false;
+	float smoothed_rtt = 0, rtt_variance = 0;
+	u32_micros retransmit_timeout = initial_retransmit_timeout;
+	float uart_byte_time = 0; // microseconds
+	u32_micros uart_transfer_time(int packet_length) const;
+	u32_micros receive_timeout(int expected_length) const;
+	void update_retransmit_timeout(u32_micros round_trip_time, int received_bytes);
 
 	// Templates for basic serialization and deserialization
 	void serialize(serial_buffer& serial_buffer, const u8& value);
@@ -133,7 +500,9 @@ private:
 	void serialize(serial_buffer& serial_buffer, const s16& value);
 	void serialize(serial_buffer& serial_buffer, const u16& value);
 	void serialize(serial_buffer& serial_buffer, const s32& value);
+	void serialize(serial_buffer& serial_buffer, const u32& value);
 	void serialize(serial_buffer& serial_buffer, const s64& value);
+	void serialize(serial_buffer& serial_buffer, const u64& value);
 	void serialize(serial_buffer& serial_buffer, const float& valuef);
 	void serialize(serial_buffer& serial_buffer, const bool& value);
 
@@ -149,6 +518,99 @@ private:
 	void deserialize(serial_buffer_iterator& it, bool& value);
 
 	serial_buffer create_odrive_packet(u16 seq_no, int endpoint, u16 response_size, const serial_buffer& payload);
-	std::vector<u8> packet_to_stream(std::vector<u8>& packet);
-	int stream_to_packet(std::vector<u8>& stream, u8* packet, int max_length);
 };
+
+// Templates from endpoint.h that need the complete ODrive class
+
+template<typename T>
+bool EndpointHandle::set_any(T value) const
+{
+	switch (type)
+	{
+	case EndpointType::boolean: odrive->set_value(id, (bool)value); return true;
+	case EndpointType::uint8:   odrive->set_value(id, (u8)value);   return true;
+	case EndpointType::int8:    odrive->set_value(id, (s8)value);   return true;
+	case EndpointType::uint16:  odrive->set_value(id, (u16)value);  return true;
+	case EndpointType::int16:   odrive->set_value(id, (s16)value);  return true;
+	case EndpointType::uint32:
+	case EndpointType::int32:   odrive->set_value(id, (s32)value);  return true;
+	case EndpointType::uint64:
+	case EndpointType::int64:   odrive->set_value(id, (s64)value);  return true;
+	case EndpointType::float32: odrive->set_value(id, (float)value); return true;
+	default:
+		odrive->communication_error = true;
+		return false;
+	}
+}
+
+template<typename T>
+bool EndpointHandle::get_any(T& value) const
+{
+	switch (type)
+	{
+	case EndpointType::boolean: odrive->get_value_as<bool>(id, value);  return true;
+	case EndpointType::uint8:   odrive->get_value_as<u8>(id, value);    return true;
+	case EndpointType::int8:    odrive->get_value_as<s8>(id, value);    return true;
+	case EndpointType::uint16:  odrive->get_value_as<u16>(id, value);   return true;
+	case EndpointType::int16:   odrive->get_value_as<s16>(id, value);   return true;
+	case EndpointType::uint32:  odrive->get_value_as<u32>(id, value);   return true;
+	case EndpointType::int32:   odrive->get_value_as<s32>(id, value);   return true;
+	case EndpointType::uint64:  odrive->get_value_as<u64>(id, value);   return true;
+	case EndpointType::int64:   odrive->get_value_as<s64>(id, value);   return true;
+	case EndpointType::float32: odrive->get_value_as<float>(id, value); return true;
+	default:
+		odrive->communication_error = true;
+		return false;
+	}
+}
+
+template<typename T>
+bool Endpoint::call_input(int& index, const T& value) const
+{
+	if (index >= num_inputs)
+		return false;
+	return inputs[index++].set_any(value);
+}
+
+template<typename T>
+bool Endpoint::call_output(int& index, T* const& value) const
+{
+	if (index >= num_outputs)
+		return false;
+	*value = T();
+	return outputs[index++].get_any(*value);
+}
+
+template<class... Args>
+void Endpoint::call(const Args&... args) const
+{
+	if (has_children() || !is_valid() || type_enum != EndpointType::function)
+	{
+		odrive->communication_error = true;
+		printf("expected %s to be a function\n", name);
+		return;
+	}
+	int passed_outputs = 0;
+	int count[] = {0, (passed_outputs += std::is_pointer<Args>::value, 0)...};
+	int passed_inputs = (int)sizeof...(Args) - passed_outputs;
+	if (passed_inputs != num_inputs || passed_outputs != num_outputs)
+	{
+		odrive->communication_error = true;
+		printf("Cannot call %s with %d parameters and %d return values. It has %d and %d.\n",
+			name, passed_inputs, passed_outputs, num_inputs, num_outputs);
+		return;
+	}
+
+	// The array initializers expand the parameter pack in order, like a fold expression in C++17.
+	odrive->call_begin(id);
+	bool ok = true;
+	int index = 0;
+	int write_inputs[] = {0, (ok = ok && call_input(index, args), 0)...};
+	ok = ok && handle().call();
+	index = 0;
+	int read_outputs[] = {0, (ok = ok && call_output(index, args), 0)...};
+	odrive->call_end();
+	(void)count; (void)index; (void)write_inputs; (void)read_outputs;
+	if (!ok)
+		printf("Cannot call %s. ID: %i\n", name, id);
+}
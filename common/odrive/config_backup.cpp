@@ -0,0 +1,201 @@
+#include "config_backup.h"
+#include "json.hpp"
+#include "../../common/time_helper.h"
+#include <string.h>
+#include <math.h>
+#include <fstream>
+
+using nlohmann::json;
+
+// json has no inf and nan, nlohmann would write them as null. Several config values are inf by
+// default, like motor.config.torque_lim, so these are written as strings.
+static json float_to_json(float value)
+{
+	if (isnan(value))
+		return "nan";
+	if (isinf(value))
+		return value > 0 ? "inf" : "-inf";
+	return value;
+}
+
+// Returns false if value is neither a number, a bool nor one of the strings of float_to_json().
+static bool json_to_float(const json& value, float& result)
+{
+	if (value.is_boolean())
+		result = (float)value.get<bool>();
+	else if (value.is_number())
+		result = value.get<float>();
+	else if (value == "nan")
+		result = NAN;
+	else if (value == "inf")
+		result = INFINITY;
+	else if (value == "-inf")
+		result = -INFINITY;
+	else
+		return false;
+	return true;
+}
+
+static bool same_float(float a, float b)
+{
+	return a == b || (isnan(a) && isnan(b));
+}
+
+static bool is_config_value(const Endpoint& endpoint)
+{
+	return !endpoint.has_children() && endpoint.is_valid() &&
+		endpoint_type_size(endpoint.type_enum) != 0 && strchr(endpoint.access, 'w');
+}
+
+void collect_config_endpoints(const Endpoint& endpoint, std::vector<ConfigValue>& values, bool in_config)
+{
+	for (int i = 0; i < endpoint.num_children; i++)
+	{
+		const Endpoint& child = endpoint.children[i];
+		bool child_in_config = in_config || strcmp(child.short_name, "config") == 0;
+		if (child.has_children())
+			collect_config_endpoints(child, values, child_in_config);
+		else if (child_in_config && is_config_value(child))
+		{
+			ConfigValue v;
+			v.endpoint = &child;
+			values.push_back(v);
+		}
+	}
+}
+
+bool read_config_values(ODrive& odrive, std::vector<ConfigValue>& values)
+{
+	odrive.pipeline_begin();
+	for (ConfigValue& v : values)
+	{
+		EndpointHandle h = v.endpoint->handle();
+		if (h.type == EndpointType::float32)
+			h.get(v.float_value);
+		else
+			h.get_any(v.int_value);
+	}
+	return odrive.pipeline_end();
+}
+
+bool save_config_backup(ODrive& odrive, const char* filename)
+{
+	std::vector<ConfigValue> values;
+	collect_config_endpoints(odrive.root, values);
+	u32_micros start_time = time_micros();
+	if (!read_config_values(odrive, values))
+	{
+		printf("Cannot read the config values\n");
+		return false;
+	}
+
+	json j_values = json::object();
+	for (const ConfigValue& v : values)
+	{
+		if (v.endpoint->type_enum == EndpointType::float32)
+			j_values[v.endpoint->name] = float_to_json(v.float_value);
+		else if (v.endpoint->type_enum == EndpointType::boolean)
+			j_values[v.endpoint->name] = v.int_value != 0;
+		else
+			j_values[v.endpoint->name] = v.int_value;
+	}
+	json j = {{"json_crc", odrive.get_json_crc()}, {"values", j_values}};
+
+	std::ofstream file(filename);
+	file << j.dump(1, '\t') << "\n";
+	if (!file)
+	{
+		printf("Cannot write %s\n", filename);
+		return false;
+	}
+	printf("Saved %d config values to %s. time: %dms\n", (int)values.size(), filename,
+		(int)((time_micros() - start_time) * .001f));
+	return true;
+}
+
+bool restore_config_backup(ODrive& odrive, const char* filename)
+{
+	std::ifstream file(filename);
+	if (!file)
+	{
+		printf("Cannot open %s\n", filename);
+		return false;
+	}
+	const bool allow_exceptions = false;
+	json j = json::parse(file, nullptr, allow_exceptions);
+	if (j.is_discarded() || !j.is_object() || !j.count("values") || !j["values"].is_object())
+	{
+		printf("%s is not a valid config backup\n", filename);
+		return false;
+	}
+	u32_micros start_time = time_micros();
+	if (!j.count("json_crc") || j["json_crc"] != odrive.get_json_crc())
+		printf("The backup is from a different firmware, the values are restored by name\n");
+
+	// Find the endpoints in this firmware, then read what they are set to right now.
+	const json& j_values = j["values"];
+	std::vector<ConfigValue> values;
+	std::vector<const json*> backup_values;
+	int num_unknown = 0;
+	for (auto it = j_values.begin(); it != j_values.end(); ++it)
+	{
+		const Endpoint* endpoint = odrive.root.find(it.key().c_str());
+		if (!endpoint || !is_config_value(*endpoint))
+		{
+			printf("Skipping %s, it is not a config value of this firmware\n", it.key().c_str());
+			num_unknown++;
+			continue;
+		}
+		float float_value;
+		bool valid = endpoint->type_enum == EndpointType::float32 ? json_to_float(it.value(), float_value) :
+			it.value().is_number() || it.value().is_boolean();
+		if (!valid)
+		{
+			printf("Skipping %s, its value %s in the backup is invalid\n", it.key().c_str(), it.value().dump().c_str());
+			num_unknown++;
+			continue;
+		}
+		ConfigValue v;
+		v.endpoint = endpoint;
+		values.push_back(v);
+		backup_values.push_back(&it.value());
+	}
+	if (!read_config_values(odrive, values))
+	{
+		printf("Cannot read the config values\n");
+		return false;
+	}
+
+	int num_written = 0;
+	odrive.pipeline_begin();
+	for (size_t i = 0; i < values.size(); i++)
+	{
+		const ConfigValue& v = values[i];
+		const json& value = *backup_values[i];
+		EndpointHandle h = v.endpoint->handle();
+		if (h.type == EndpointType::float32)
+		{
+			float backup_value = 0;
+			json_to_float(value, backup_value);
+			if (same_float(backup_value, v.float_value))
+				continue;
+			h.set(backup_value);
+		}
+		else
+		{
+			s64 backup_value = value.is_boolean() ? (s64)value.get<bool>() : value.get<s64>();
+			if (backup_value == v.int_value)
+				continue;
+			h.set_any(backup_value);
+		}
+		num_written++;
+	}
+	if (!odrive.pipeline_end())
+	{
+		printf("Cannot write the config values\n");
+		return false;
+	}
+	printf("Restored config from %s: %d values written, %d unchanged, %d skipped. time: %dms\n", filename,
+		num_written, (int)values.size()-num_written, num_unknown, (int)((time_micros() - start_time) * .001f));
+	return true;
+}
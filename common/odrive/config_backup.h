@@ -0,0 +1,29 @@
+// Backup and restore of the whole configuration of an ODrive.
+// Config values are all writable endpoints below an object called "config", like
+// .config.brake_resistance or .axis0.motor.config.pole_pairs. They are found by walking the
+// endpoint tree, so this works with any firmware. All values are read or written in one
+// pipelined batch, which takes a few round trips instead of one per value.
+// The backup is a json file with the full paths as keys. json has no inf and nan, so those
+// float values are written as the strings "inf", "-inf" and "nan".
+#pragma once
+#include "ODrive.h"
+#include <vector>
+
+struct ConfigValue
+{
+	const Endpoint* endpoint;
+	// Float endpoints are read as float, all others as s64, so no precision is lost.
+	float float_value = 0;
+	s64 int_value = 0;
+};
+
+// Collects all config endpoints below endpoint.
+void collect_config_endpoints(const Endpoint& endpoint, std::vector<ConfigValue>& values, bool in_config = false);
+// Reads the values of all endpoints in values. Returns false on communication error.
+bool read_config_values(ODrive& odrive, std::vector<ConfigValue>& values);
+
+bool save_config_backup(ODrive& odrive, const char* filename);
+// Writes only the values in the backup that differ from the ones on ODrive. Values that don't
+// exist in this firmware are skipped with a warning. The config is not saved to flash, call
+// save_configuration() for that.
+bool restore_config_backup(ODrive& odrive, const char* filename);
@@ -0,0 +1,109 @@
+// The CRCs of the UART framing of fibre (see ODrive::packet_to_stream()). calc_crc8() and
+// calc_crc16() use lookup tables that are generated at compile time. calc_crc_bitwise() is the
+// reference they are generated from and checked against, crc_check compares them.
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+
+// Calculates an arbitrary CRC for one byte.
+// Adapted from https://barrgroup.com/Embedded-Systems/How-To/CRC-Calculation-C-Code
+// This goes bit by bit and is only used as the reference to generate the lookup tables below.
+template<typename T, unsigned POLYNOMIAL>
+static constexpr T calc_crc_bitwise(T remainder, uint8_t value)
+{
+    constexpr T BIT_WIDTH = (8 * sizeof(T));
+    constexpr T TOPBIT = ((T)1 << (BIT_WIDTH - 1));
+    
+    // Bring the next byte into the remainder.
+    remainder ^= (value << (BIT_WIDTH - 8));
+
+    // Perform modulo-2 division, a bit at a time.
+    for (uint8_t bit = 8; bit; --bit) {
+        if (remainder & TOPBIT) {
+            remainder = (remainder << 1) ^ POLYNOMIAL;
+        } else {
+            remainder = (remainder << 1);
+        }
+    }
+
+    return remainder;
+}
+
+template<typename T, unsigned POLYNOMIAL>
+static constexpr T calc_crc_bitwise(T remainder, const uint8_t* buffer, size_t length) {
+    while (length--)
+        remainder = calc_crc_bitwise<T, POLYNOMIAL>(remainder, *(buffer++));
+    return remainder;
+}
+
+// Lookup tables for the CRC, generated at compile time.
+// table[0][x] is the crc of the byte x (starting with a zero remainder). table[k][x] is the crc of
+// x followed by k zero bytes. With these we can process SLICES bytes with one lookup per byte
+// and without a dependency between the lookups (slicing-by-N).
+template<typename T, unsigned POLYNOMIAL, int SLICES>
+struct CrcTable
+{
+    T table[SLICES][256];
+
+    constexpr CrcTable() : table()
+    {
+        for (int x = 0; x < 256; x++)
+            table[0][x] = calc_crc_bitwise<T, POLYNOMIAL>(0, (uint8_t)x);
+        for (int k = 1; k < SLICES; k++)
+            for (int x = 0; x < 256; x++)
+                table[k][x] = (T)(table[k-1][x] << 8) ^ table[0][(uint8_t)(table[k-1][x] >> (8*sizeof(T)-8))];
+    }
+};
+
+template<typename T, unsigned POLYNOMIAL, int SLICES>
+static constexpr CrcTable<T, POLYNOMIAL, SLICES> crc_table{};
+
+template<typename T, unsigned POLYNOMIAL, int SLICES>
+static constexpr T calc_crc(T remainder, const uint8_t* buffer, size_t length) {
+    static_assert(SLICES >= (int)sizeof(T), "");
+    const auto& table = crc_table<T, POLYNOMIAL, SLICES>.table;
+    while (length >= SLICES) {
+        // The remainder is combined with the first bytes, all other bytes go in as they are.
+        T r = 0;
+        for (int i = 0; i < SLICES; i++) {
+            uint8_t x = buffer[i];
+            if (i < (int)sizeof(T))
+                x ^= (uint8_t)(remainder >> (8*(sizeof(T)-1-i)));
+            r ^= table[SLICES-1-i][x];
+        }
+        remainder = r;
+        buffer += SLICES;
+        length -= SLICES;
+    }
+    while (length--)
+        remainder = (T)(remainder << 8) ^ table[0][(uint8_t)(remainder >> (8*sizeof(T)-8)) ^ *(buffer++)];
+    return remainder;
+}
+
+// How many bytes the crc16 processes at once. Can be 2, 4 or 8. More is faster for long packets,
+// but needs a bigger table (512 bytes per slice).
+#ifndef ODRIVE_CRC16_SLICES
+#define ODRIVE_CRC16_SLICES 4
+#endif
+
+template<unsigned POLYNOMIAL>
+static constexpr uint8_t calc_crc8(uint8_t remainder, const uint8_t* buffer, size_t length) {
+    return calc_crc<uint8_t, POLYNOMIAL, 1>(remainder, buffer, length);
+}
+
+template<unsigned POLYNOMIAL>
+static constexpr uint16_t calc_crc16(uint16_t remainder, const uint8_t* buffer, size_t length) {
+    return calc_crc<uint16_t, POLYNOMIAL, ODRIVE_CRC16_SLICES>(remainder, buffer, length);
+}
+
+constexpr uint8_t CANONICAL_CRC8_POLYNOMIAL = 0x37;
+constexpr uint8_t CANONICAL_CRC8_INIT = 0x42;
+constexpr uint16_t CANONICAL_CRC16_POLYNOMIAL = 0x3d65;
+constexpr uint16_t CANONICAL_CRC16_INIT = 0x1337;
+
+// Make sure the table versions compute the same as the bitwise reference.
+constexpr uint8_t crc_check_data[] = {0xaa, 0x0d, 0x5f, 0x81, 0x00, 0x32, 0x80, 0x04, 0x00, 0x00, 0x00, 0x37, 0x13, 0xff, 0x01};
+static_assert(calc_crc8<CANONICAL_CRC8_POLYNOMIAL>(CANONICAL_CRC8_INIT, crc_check_data, sizeof(crc_check_data)) ==
+    calc_crc_bitwise<uint8_t, CANONICAL_CRC8_POLYNOMIAL>(CANONICAL_CRC8_INIT, crc_check_data, sizeof(crc_check_data)), "crc8 table is wrong");
+static_assert(calc_crc16<CANONICAL_CRC16_POLYNOMIAL>(CANONICAL_CRC16_INIT, crc_check_data, sizeof(crc_check_data)) ==
+    calc_crc_bitwise<uint16_t, CANONICAL_CRC16_POLYNOMIAL>(CANONICAL_CRC16_INIT, crc_check_data, sizeof(crc_check_data)), "crc16 table is wrong");
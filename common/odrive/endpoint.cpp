@@ -1,16 +1,254 @@
 #include "endpoint.h"
 #include "ODrive.h"
+#include <string.h>
+#include <algorithm>
 
 
+static bool string_equals(const char* str, int length, const char* literal)
+{
+	return (int)strlen(literal) == length && memcmp(str, literal, length) == 0;
+}
+
+EndpointType endpoint_type_from_string(const char* type, int length)
+{
+	if (string_equals(type, length, "object"  )) return EndpointType::object;
+	if (string_equals(type, length, "function")) return EndpointType::function;
+	if (string_equals(type, length, "bool"    )) return EndpointType::boolean;
+	if (string_equals(type, length, "uint8"   )) return EndpointType::uint8;
+	if (string_equals(type, length, "int8"    )) return EndpointType::int8;
+	if (string_equals(type, length, "uint16"  )) return EndpointType::uint16;
+	if (string_equals(type, length, "int16"   )) return EndpointType::int16;
+	if (string_equals(type, length, "uint32"  )) return EndpointType::uint32;
+	if (string_equals(type, length, "int32"   )) return EndpointType::int32;
+	if (string_equals(type, length, "uint64"  )) return EndpointType::uint64;
+	if (string_equals(type, length, "int64"   )) return EndpointType::int64;
+	if (string_equals(type, length, "float"   )) return EndpointType::float32;
+	return EndpointType::invalid;
+}
+
+EndpointType endpoint_type_from_string(const std::string& type)
+{
+	return endpoint_type_from_string(type.data(), (int)type.size());
+}
+
+int endpoint_type_size(EndpointType type)
+{
+	switch (type)
+	{
+	case EndpointType::boolean:
+	case EndpointType::uint8:
+	case EndpointType::int8:
+		return 1;
+	case EndpointType::uint16:
+	case EndpointType::int16:
+		return 2;
+	case EndpointType::uint32:
+	case EndpointType::int32:
+	case EndpointType::float32:
+		return 4;
+	case EndpointType::uint64:
+	case EndpointType::int64:
+		return 8;
+	default:
+		return 0;
+	}
+}
+
+bool EndpointHandle::set(float value) const {
+	if (type == EndpointType::float32)
+	{
+		odrive->set_value(id, value);
+		return true;
+	}
+	odrive->communication_error = true;
+	return false;
+}
+
+bool EndpointHandle::set(s32 value) const {
+	switch (type)
+	{
+	case EndpointType::uint32:
+	case EndpointType::int32:
+		odrive->set_value(id, value);
+		return true;
+	case EndpointType::uint8:
+		assert(value >= 0 && value < 256);
+		odrive->set_value(id, (u8)value);
+		return true;
+	case EndpointType::int8:
+		assert(value >= -128 && value < 128);
+		odrive->set_value(id, (s8)value);
+		return true;
+	case EndpointType::uint16:
+		assert(value >= 0 && value < 65536);
+		odrive->set_value(id, (u16)value);
+		return true;
+	case EndpointType::int16:
+		assert(value >= -32768 && value < 32768);
+		odrive->set_value(id, (s16)value);
+		return true;
+	case EndpointType::uint64:
+		odrive->set_value(id, (s64)value);
+		return true;
+	default:
+		odrive->communication_error = true;
+		return false;
+	}
+}
+
+bool EndpointHandle::set(s64 value) const {
+	if (type == EndpointType::uint64 || type == EndpointType::int64)
+	{
+		odrive->set_value(id, value);
+		return true;
+	}
+	odrive->communication_error = true;
+	return false;
+}
+
+bool EndpointHandle::set(bool value) const {
+	if (type == EndpointType::boolean)
+	{
+		odrive->set_value(id, value);
+		return true;
+	}
+	odrive->communication_error = true;
+	return false;
+}
+
+bool EndpointHandle::get(float& value) const {
+	if (type == EndpointType::float32)
+	{
+		odrive->get_value(id, value);
+		return true;
+	}
+	odrive->communication_error = true;
+	return false;
+}
+
+bool EndpointHandle::get(u8& value) const {
+	if (type == EndpointType::uint8 || type == EndpointType::int8)
+	{
+		odrive->get_value(id, value);
+		return true;
+	}
+	odrive->communication_error = true;
+	return false;
+}
+
+bool EndpointHandle::get(s32& value) const {
+	switch (type)
+	{
+	case EndpointType::uint32:
+	case EndpointType::int32:
+		odrive->get_value(id, value);
+		return true;
+	case EndpointType::uint16:
+	case EndpointType::int16:
+		odrive->get_value_as<s16>(id, value);
+		return true;
+	case EndpointType::uint8:
+	case EndpointType::int8:
+		odrive->get_value_as<s8>(id, value);
+		return true;
+	default:
+		odrive->communication_error = true;
+		return false;
+	}
+}
+
+bool EndpointHandle::get(s64& value) const {
+	switch (type)
+	{
+	case EndpointType::uint64:
+	case EndpointType::int64:
+		odrive->get_value(id, value);
+		return true;
+	case EndpointType::uint32:
+		odrive->get_value_as<u32>(id, value);
+		return true;
+	case EndpointType::int32:
+		odrive->get_value_as<s32>(id, value);
+		return true;
+	case EndpointType::uint16:
+	case EndpointType::int16:
+		odrive->get_value_as<s16>(id, value);
+		return true;
+	case EndpointType::uint8:
+	case EndpointType::int8:
+		odrive->get_value_as<s8>(id, value);
+		return true;
+	default:
+		odrive->communication_error = true;
+		return false;
+	}
+}
+
+bool EndpointHandle::get(u64& value) const {
+	if (type == EndpointType::uint64 || type == EndpointType::int64)
+	{
+		odrive->get_value(id, value);
+		return true;
+	}
+	odrive->communication_error = true;
+	return false;
+}
+
+bool EndpointHandle::get(bool& value) const {
+	if (type == EndpointType::boolean)
+	{
+		odrive->get_value(id, value);
+		return true;
+	}
+	odrive->communication_error = true;
+	return false;
+}
+
+bool EndpointHandle::call() const {
+	if (type == EndpointType::function)
+	{
+		odrive->call(id);
+		return true;
+	}
+	odrive->communication_error = true;
+	return false;
+}
+
+// Compares like strcmp, but name doesn't have to be terminated after length characters.
+static int compare_name(const char* short_name, const char* name, int length)
+{
+	int c = strncmp(short_name, name, length);
+	if (c == 0 && short_name[length])
+		return 1;
+	return c;
+}
+
+static Endpoint* find_child(Endpoint* children, int num_children, const char* name, int length)
+{
+	int low = 0, high = num_children;
+	while (low < high)
+	{
+		int mid = (low+high) / 2;
+		int c = compare_name(children[mid].short_name, name, length);
+		if (c == 0)
+			return &children[mid];
+		if (c < 0)
+			low = mid+1;
+		else
+			high = mid;
+	}
+	return nullptr;
+}
+
 Endpoint& Endpoint::operator() (const char* name) {
-	auto it = children.find(name);
-	if (it == children.end())
+	Endpoint* child = find_child(children, num_children, name, (int)strlen(name));
+	if (!child)
 	{
-		printf("odrive: cannot find %s in %s!\n", name, this->name.size() ? this->name.c_str() : "root");
+		printf("odrive: cannot find %s in %s!\n", name, this->name[0] ? this->name : "root");
 		odrive->communication_error = true;
 		return *this;
 	}
-	return it->second;
+	return *child;
 }
 
 bool Endpoint::is_valid() const {
@@ -18,219 +256,517 @@ bool Endpoint::is_valid() const {
 }
 
 bool Endpoint::has_children() const {
-	return !children.empty();
+	return num_children != 0;
 }
 
 bool Endpoint::has_child(const char* name) const {
-	return children.find(name) != children.end();
+	return find_child(children, num_children, name, (int)strlen(name)) != nullptr;
 }
 
-void Endpoint::set(float value) const {
-	if (!has_children() && is_valid() && type == "float")
+const Endpoint* Endpoint::find(const char* path) const {
+	const Endpoint* endpoint = this;
+	while (*path)
 	{
-		odrive->set_value(id, value);
+		if (*path == '.')
+			path++;
+		const char* end = path;
+		while (*end && *end != '.')
+			end++;
+		endpoint = find_child(endpoint->children, endpoint->num_children, path, (int)(end-path));
+		if (!endpoint)
+			return nullptr;
+		path = end;
 	}
-	else
+	return endpoint;
+}
+
+EndpointHandle Endpoint::handle() const {
+	EndpointHandle h;
+	h.odrive = odrive;
+	if (!has_children() && is_valid())
 	{
-		printf("Cannot write float %s. ID: %i access: %s type: %s\n", name.c_str(), id, access.c_str(), type.c_str());
-		odrive->communication_error = true;
+		h.id = id;
+		h.type = type_enum;
+		h.size = (u8)endpoint_type_size(type_enum);
 	}
+	return h;
 }
 
+void Endpoint::set(float value) const {
+	if (!handle().set(value))
+		printf("Cannot write float %s. ID: %i access: %s type: %s\n", name, id, access, type);
+}
 
 void Endpoint::set(s32 value) const {
-	if (!has_children() && is_valid())
+	if (!handle().set(value))
+		printf("Cannot write int %s. ID: %i access: %s type: %s\n", name, id, access, type);
+}
+
+void Endpoint::set(s64 value) const {
+	if (!handle().set(value))
+		printf("Cannot write s64 %s. ID: %i access: %s type: %s\n", name, id, access, type);
+}
+
+void Endpoint::set(bool value) const {
+	if (!handle().set(value))
+		printf("Cannot write bool %s. ID: %i access: %s type: %s\n", name, id, access, type);
+}
+
+void Endpoint::get(float& value) const {
+	if (!handle().get(value))
+		printf("Cannot read float %s. ID: %i access: %s type: %s\n", name, id, access, type);
+}
+
+void Endpoint::get(s32& value) const {
+	if (!handle().get(value))
+		printf("Cannot read int %s. ID: %i access: %s type: %s\n", name, id, access, type);
+}
+
+void Endpoint::get(u8& value) const {
+	if (!handle().get(value))
+		printf("Cannot read u8 %s. ID: %i access: %s type: %s\n", name, id, access, type);
+}
+
+void Endpoint::get(s64& value) const {
+	if (!handle().get(value))
+		printf("Cannot read s64 %s. ID: %i access: %s type: %s\n", name, id, access, type);
+}
+
+void Endpoint::get(u64& value) const {
+	if (!handle().get(value))
+		printf("Cannot read u64 %s. ID: %i access: %s type: %s\n", name, id, access, type);
+}
+
+void Endpoint::get(bool& value) const {
+	if (!handle().get(value))
+		printf("Cannot read bool %s. ID: %i access: %s type: %s\n", name, id, access, type);
+}
+
+ODriveVersion Endpoint::get_odrive_fw_version()
+{
+	return odrive->odrive_fw_version;
+}
+bool Endpoint::odrive_fw_is_milana()
+{
+	return odrive->odrive_fw_is_milana;
+}
+
+
+// A minimal json reader for the json interface. It reads the text in place and only copies
+// strings that contain escape sequences.
+struct JsonReader
+{
+	const char* p;
+	const char* end;
+	bool error = false;
+	std::string scratch;
+
+	void skip_whitespace()
+	{
+		while (p < end && (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r'))
+			p++;
+	}
+	bool peek(char c)
+	{
+		skip_whitespace();
+		return p < end && *p == c;
+	}
+	bool expect(char c)
+	{
+		if (!peek(c))
+		{
+			error = true;
+			return false;
+		}
+		p++;
+		return true;
+	}
+
+	bool read_string(const char** str, int* length)
 	{
-		if (type == "uint32" || type == "int32")
+		if (!expect('"'))
+			return false;
+		const char* start = p;
+		while (p < end && *p != '"' && *p != '\\')
+			p++;
+		if (p < end && *p == '"')
 		{
-			odrive->set_value(id, value);
-			//printf("Set ID %i with float: %d\n", id, value);
-			return;
+			*str = start;
+			*length = (int)(p-start);
+			p++;
+			return true;
 		}
-		else if (type == "uint8")
+		// The string has escape sequences, so it has to be decoded.
+		scratch.assign(start, p);
+		while (p < end && *p != '"')
 		{
-			assert(value >= 0 && value < 256);
-			u8 val = value;
-			odrive->set_value(id, val);
-			return;
+			char c = *p++;
+			if (c == '\\' && p < end)
+			{
+				c = *p++;
+				switch (c)
+				{
+				case 'n': c = '\n'; break;
+				case 't': c = '\t'; break;
+				case 'r': c = '\r'; break;
+				case 'b': c = '\b'; break;
+				case 'f': c = '\f'; break;
+				case 'u': p = std::min(p+4, end); c = '?'; break; // ODrive names are ascii
+				}
+			}
+			scratch.push_back(c);
 		}
-		else if (type == "int8")
+		if (!expect('"'))
+			return false;
+		*str = scratch.data();
+		*length = (int)scratch.size();
+		return true;
+	}
+
+	bool read_int(int* value)
+	{
+		skip_whitespace();
+		bool negative = p < end && *p == '-';
+		if (negative)
+			p++;
+		if (p >= end || *p < '0' || *p > '9')
 		{
-			assert(value >= -128 && value < 128);
-			s8 val = value;
-			odrive->set_value(id, val);
-			return;
+			error = true;
+			return false;
 		}
-		else if (type == "uint16")
+		long long v = 0;
+		while (p < end && *p >= '0' && *p <= '9')
+			v = v*10 + (*p++ - '0');
+		*value = (int)(negative ? -v : v);
+		return true;
+	}
+
+	bool skip_value()
+	{
+		skip_whitespace();
+		if (p >= end)
 		{
-			assert(value >= 0 && value < 65536);
-			u16 val = value;
-			odrive->set_value(id, val);
-			return;
+			error = true;
+			return false;
 		}
-		else if (type == "int16")
+		if (*p == '"')
 		{
-			assert(value >= -32768 && value < 32768);
-			s16 val = value;
-			odrive->set_value(id, val);
-			return;
+			const char* str;
+			int length;
+			return read_string(&str, &length);
 		}
-		else if (type == "uint64" || type == "uint32")
+		if (*p == '{' || *p == '[')
 		{
-			s64 val = value;
-			odrive->set_value(id, val);
-			return;
+			char close = *p == '{' ? '}' : ']';
+			bool is_object = *p == '{';
+			p++;
+			if (peek(close))
+			{
+				p++;
+				return true;
+			}
+			do
+			{
+				if (is_object)
+				{
+					const char* key;
+					int length;
+					if (!read_string(&key, &length) || !expect(':'))
+						return false;
+				}
+				if (!skip_value())
+					return false;
+			} while (peek(',') && p++);
+			return expect(close);
 		}
+		// number, true, false or null
+		const char* start = p;
+		while (p < end && *p != ',' && *p != '}' && *p != ']' && *p != ' ' && *p != '\n' && *p != '\r' && *p != '\t')
+			p++;
+		if (p == start)
+			error = true;
+		return !error;
 	}
-	printf("Cannot write int %s. ID: %i access: %s type: %s\n", name.c_str(), id, access.c_str(), type.c_str());
-	odrive->communication_error = true;
-}
 
-void Endpoint::set(s64 value) const {
-	if (!has_children() && is_valid())
+	// Calls on_element for every element of an array. on_element has to read the element.
+	template<typename F>
+	bool read_array(F on_element)
 	{
-		if (type == "uint64" || type == "int64")
+		if (!expect('['))
+			return false;
+		if (peek(']'))
 		{
-			odrive->set_value(id, value);
-			return;
+			p++;
+			return true;
 		}
+		do
+		{
+			if (!on_element())
+				return false;
+		} while (peek(',') && p++);
+		return expect(']');
 	}
-	printf("Cannot write s64 %s. ID: %i access: %s type: %s\n", name.c_str(), id, access.c_str(), type.c_str());
-	odrive->communication_error = true;
-}
 
-void Endpoint::set(bool value) const {
-	if (!has_children() && is_valid() && type == "bool")
+	// Calls on_member with the key for every member of an object. on_member has to read the value.
+	template<typename F>
+	bool read_object(F on_member)
 	{
-		odrive->set_value(id, value);
-		//printf("Set ID %i with float: %d\n", id, value);
+		if (!expect('{'))
+			return false;
+		if (peek('}'))
+		{
+			p++;
+			return true;
+		}
+		do
+		{
+			const char* key;
+			int length;
+			if (!read_string(&key, &length) || !expect(':'))
+				return false;
+			// key may point into scratch, so on_member has to look at it before reading the value.
+			if (!on_member(key, length))
+				return false;
+		} while (peek(',') && p++);
+		return expect('}');
 	}
-	else
+};
+
+// Builds an EndpointTable. The endpoints are first collected in the order of the json with the
+// index of their parent. Afterwards the children of every endpoint are moved next to each other.
+struct EndpointTableBuilder
+{
+	struct ParsedEndpoint
 	{
-		odrive->communication_error = true;
-		printf("Cannot write bool %s. ID: %i access: %s type: %s\n", name.c_str(), id, access.c_str(), type.c_str());
-	}
-}
+		int parent;
+		int id = -1;
+		int name_offset = 0, name_length = 0; // in names
+		EndpointType type = EndpointType::invalid;
+		int type_offset = -1, access_offset = -1; // in EndpointTable::strings
+		int first_input = 0, num_inputs = 0;
+		int first_output = 0, num_outputs = 0;
+	};
 
-void Endpoint::get(float& value) const {
-	if (!has_children() && is_valid()) {
-		if (type == "float") {
-			odrive->get_value(id, value);
-			//printf("got %.2f from ID %i\n", value, id);
-			return;
+	JsonReader reader;
+	ODrive* odrive;
+	EndpointTable& table;
+	std::vector<ParsedEndpoint> parsed;
+	std::vector<char> names;
+	std::vector<int> interned; // offsets of the type and access strings
+
+	EndpointTableBuilder(EndpointTable& table) : table(table) {}
+
+	// There are only a few different types and access strings, so a linear search is fine.
+	int intern(const char* str, int length)
+	{
+		for (int offset : interned)
+		{
+			if (string_equals(str, length, &table.strings[offset]))
+				return offset;
 		}
+		int offset = (int)table.strings.size();
+		table.strings.insert(table.strings.end(), str, str+length);
+		table.strings.push_back(0);
+		interned.push_back(offset);
+		return offset;
 	}
-	printf("Cannot read float %s. ID: %i access: %s type: %s\n", name.c_str(), id, access.c_str(), type.c_str());
-	odrive->communication_error = true;
-}
 
-void Endpoint::get(s32& value) const {
-	if (!has_children() && is_valid()) {
-		if (type == "uint32" || type == "int32") {
-			odrive->get_value(id, value);
-			//printf("got int32 %d from ID %i %s\n", (int)value, id, name.c_str());
-			return;
-		}
-		else if (type == "uint16" || type == "int16") {
-			s16 val = 0;
-			odrive->get_value(id, val);
-			//printf("got %d from ID %i\n", value, id);
-			value = val;
-			return;
-		}
-		else if (type == "uint8" || type == "int8") {
-			s8 val = 0;
-			odrive->get_value(id, val);
-			//printf("got u8 %d from ID %i %s\n", (int)value, id, name.c_str());
-			value = val;
-			return;
-		}
+	bool read_args(int* first, int* count)
+	{
+		*first = (int)table.function_args.size();
+		bool ok = reader.read_array([&]
+		{
+			EndpointHandle h;
+			h.odrive = odrive;
+			return reader.read_object([&](const char* key, int length)
+			{
+				if (string_equals(key, length, "id"))
+					return reader.read_int(&h.id);
+				if (string_equals(key, length, "type"))
+				{
+					const char* type;
+					int type_length;
+					if (!reader.read_string(&type, &type_length))
+						return false;
+					h.type = endpoint_type_from_string(type, type_length);
+					h.size = (u8)endpoint_type_size(h.type);
+					return true;
+				}
+				return reader.skip_value();
+			}) && (table.function_args.push_back(h), true);
+		});
+		*count = (int)table.function_args.size() - *first;
+		return ok;
 	}
-	printf("Cannot read int %s. ID: %i access: %s type: %s\n", name.c_str(), id, access.c_str(), type.c_str());
-	odrive->communication_error = true;
-}
 
-void Endpoint::get(u8& value) const {
-	if (!has_children() && is_valid()) {
-		if (type == "uint8" || type == "int8") {
-			odrive->get_value(id, value);
-			//printf("got %d from ID %i\n", value, id);
-			return;
-		}
+	bool read_endpoints(int parent)
+	{
+		return reader.read_array([&] { return read_endpoint(parent); });
 	}
-	printf("Cannot read u8 %s. ID: %i access: %s type: %s\n", name.c_str(), id, access.c_str(), type.c_str());
-	odrive->communication_error = true;
-}
 
-void Endpoint::get(s64& value) const {
-	if (!has_children() && is_valid()) {
-		if (type == "uint64" || type == "int64") {
-			odrive->get_value(id, value);
-			//printf("got %d from ID %i\n", value, id);
-			return;
-		}
-		else if (type == "uint32") {
-			u32 val = 0;
-			odrive->get_value(id, val);
-			//printf("got %d from ID %i\n", value, id);
-			value = val;
-			return;
-		}
-		else if (type == "int32") {
-			s32 val = 0;
-			odrive->get_value(id, val);
-			//printf("got %d from ID %i\n", value, id);
-			value = val;
-			return;
-		}
-		else if (type == "uint16" || type == "int16") {
-			s16 val = 0;
-			odrive->get_value(id, val);
-			//printf("got %d from ID %i\n", value, id);
-			value = val;
-			return;
+	bool read_endpoint(int parent)
+	{
+		int index = (int)parsed.size();
+		ParsedEndpoint e;
+		e.parent = parent;
+		parsed.push_back(e);
+		// parsed grows while the members are read, so this always indexes it again.
+		return reader.read_object([&](const char* key, int length)
+		{
+			const char* str;
+			int str_length;
+			if (string_equals(key, length, "name"))
+			{
+				if (!reader.read_string(&str, &str_length))
+					return false;
+				parsed[index].name_offset = (int)names.size();
+				parsed[index].name_length = str_length;
+				names.insert(names.end(), str, str+str_length);
+				return true;
+			}
+			if (string_equals(key, length, "id"))
+				return reader.read_int(&parsed[index].id);
+			if (string_equals(key, length, "type"))
+			{
+				if (!reader.read_string(&str, &str_length))
+					return false;
+				parsed[index].type = endpoint_type_from_string(str, str_length);
+				parsed[index].type_offset = intern(str, str_length);
+				return true;
+			}
+			if (string_equals(key, length, "access"))
+			{
+				if (!reader.read_string(&str, &str_length))
+					return false;
+				parsed[index].access_offset = intern(str, str_length);
+				return true;
+			}
+			if (string_equals(key, length, "members"))
+				return read_endpoints(index);
+			if (string_equals(key, length, "inputs"))
+			{
+				int first, count;
+				bool ok = read_args(&first, &count);
+				parsed[index].first_input = first;
+				parsed[index].num_inputs = count;
+				return ok;
+			}
+			if (string_equals(key, length, "outputs"))
+			{
+				int first, count;
+				bool ok = read_args(&first, &count);
+				parsed[index].first_output = first;
+				parsed[index].num_outputs = count;
+				return ok;
+			}
+			return reader.skip_value();
+		});
+	}
+
+	void build()
+	{
+		int n = (int)parsed.size();
+
+		// The full paths are built from the path of the parent, which always comes first.
+		std::vector<int> path_offset(n), path_length(n);
+		size_t strings_size = table.strings.size();
+		for (int i = 0; i < n; i++)
+		{
+			int parent = parsed[i].parent;
+			path_length[i] = (parent < 0 ? 0 : path_length[parent]) + 1 + parsed[i].name_length;
+			strings_size += path_length[i]+1;
 		}
-		else if (type == "uint8" || type == "int8") {
-			s8 val = 0;
-			odrive->get_value(id, val);
-			//printf("got u8 %d from ID %i %s\n", (int)value, id, name.c_str());
-			value = val;
-			return;
+		table.strings.reserve(strings_size);
+		for (int i = 0; i < n; i++)
+		{
+			int parent = parsed[i].parent;
+			path_offset[i] = (int)table.strings.size();
+			if (parent >= 0)
+			{
+				const char* parent_path = &table.strings[path_offset[parent]];
+				table.strings.insert(table.strings.end(), parent_path, parent_path+path_length[parent]);
+			}
+			table.strings.push_back('.');
+			table.strings.insert(table.strings.end(), names.begin()+parsed[i].name_offset,
+				names.begin()+parsed[i].name_offset+parsed[i].name_length);
+			table.strings.push_back(0);
 		}
-	}
-	printf("Cannot read s64 %s. ID: %i access: %s type: %s\n", name.c_str(), id, access.c_str(), type.c_str());
-	odrive->communication_error = true;
-}
 
-void Endpoint::get(u64& value) const {
-	if (!has_children() && is_valid()) {
-		if (type == "uint64" || type == "int64") {
-			odrive->get_value(id, value);
-			//printf("got %d from ID %i\n", value, id);
-			return;
+		// Place the children of each endpoint next to each other. Index 0 is the root, index
+		// i+1 is parsed[i].
+		std::vector<int> num_children(n+1, 0), first_child(n+1, 0), position(n);
+		for (int i = 0; i < n; i++)
+			num_children[parsed[i].parent+1]++;
+		for (int i = 1; i <= n; i++)
+			first_child[i] = first_child[i-1] + num_children[i-1];
+		std::vector<int> next = first_child;
+		for (int i = 0; i < n; i++)
+			position[i] = next[parsed[i].parent+1]++;
+
+		table.endpoints.resize(n);
+		Endpoint* endpoints = table.endpoints.data();
+		for (int i = 0; i < n; i++)
+		{
+			const ParsedEndpoint& p = parsed[i];
+			Endpoint& e = endpoints[position[i]];
+			e.odrive = odrive;
+			e.id = p.id;
+			e.name = &table.strings[path_offset[i]];
+			e.short_name = e.name + path_length[i] - p.name_length;
+			if (p.type_offset >= 0)
+				e.type = &table.strings[p.type_offset];
+			if (p.access_offset >= 0)
+				e.access = &table.strings[p.access_offset];
+			e.type_enum = p.type;
+			e.children = endpoints + first_child[i+1];
+			e.num_children = num_children[i+1];
+			e.inputs = table.function_args.data() + p.first_input;
+			e.num_inputs = p.num_inputs;
+			e.outputs = table.function_args.data() + p.first_output;
+			e.num_outputs = p.num_outputs;
 		}
-	}
-	printf("Cannot read u64 %s. ID: %i access: %s type: %s\n", name.c_str(), id, access.c_str(), type.c_str());
-	odrive->communication_error = true;
-}
+		table.root = Endpoint();
+		table.root.odrive = odrive;
+		table.root.children = endpoints;
+		table.root.num_children = num_children[0];
 
-void Endpoint::get(bool& value) const {
-	if (!has_children() && is_valid()) {
-		if (type == "bool") {
-			odrive->get_value(id, value);
-			//printf("got %d from ID %i\n", value, id);
-			return;
+		auto by_name = [](const Endpoint& a, const Endpoint& b) { return strcmp(a.short_name, b.short_name) < 0; };
+		for (int i = 0; i <= n; i++)
+		{
+			if (num_children[i] > 1)
+				std::sort(endpoints + first_child[i], endpoints + first_child[i] + num_children[i], by_name);
 		}
 	}
-	printf("Cannot read bool %s. ID: %i access: %s type: %s\n", name.c_str(), id, access.c_str(), type.c_str());
-	odrive->communication_error = true;
-}
+};
 
-ODriveVersion Endpoint::get_odrive_fw_version()
+bool EndpointTable::parse(const char* json, size_t length, ODrive* odrive)
 {
-	return odrive->odrive_fw_version;
+	clear();
+	EndpointTableBuilder builder(*this);
+	builder.odrive = odrive;
+	builder.reader.p = json;
+	builder.reader.end = json + length;
+	builder.parsed.reserve(length / 64);
+	builder.names.reserve(length / 8);
+	if (!builder.read_endpoints(-1))
+	{
+		clear();
+		return false;
+	}
+	builder.reader.skip_whitespace();
+	if (builder.reader.p != builder.reader.end)
+	{
+		clear();
+		return false;
+	}
+	builder.build();
+	return true;
 }
-bool Endpoint::odrive_fw_is_milana()
+
+void EndpointTable::clear()
 {
-	return odrive->odrive_fw_is_milana;
+	root = Endpoint();
+	endpoints.clear();
+	function_args.clear();
+	strings.clear();
 }
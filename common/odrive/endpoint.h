@@ -1,6 +1,6 @@
-// This class holds ODrive endpoints (or any endpoint really) in a std::map  
-// which contains the endpoint name and endpoint id. Each endpoint can also 
-// have a child (root has child, 'motor0'. 'motor0' has child, 'pos_setpoint').
+// This class holds ODrive endpoints (or any endpoint really) with their name and
+// endpoint id. Each endpoint can also have children (root has child, 'motor0'.
+// 'motor0' has child, 'pos_setpoint'). All endpoints are stored in one EndpointTable.
 // This class also implements the abstraction from the ODrive class, essentially
 // providing a direct interface from an Endpoint to a endpoint on the ODrive hardware.
 
@@ -8,7 +8,6 @@
 #include <cstdint>
 #include <string>
 #include <vector>
-#include <map>
 #include <iterator>
 #include <assert.h>
 #include "../../common/helper.h" // This is just needed for basic int type definitions, you can copy those into this file if you want to use this in your project
@@ -20,22 +19,91 @@ using ODriveVersion = int;
 const ODriveVersion odrive_version_0_5_1 = 5001;
 const ODriveVersion odrive_version_0_5_6 = 5006;
 
+// The type of an endpoint as given by the "type" field in the json interface.
+enum class EndpointType : u8
+{
+	invalid,
+	object,
+	function,
+	boolean,
+	uint8,
+	int8,
+	uint16,
+	int16,
+	uint32,
+	int32,
+	uint64,
+	int64,
+	float32,
+};
+
+EndpointType endpoint_type_from_string(const std::string& type);
+EndpointType endpoint_type_from_string(const char* type, int length);
+int endpoint_type_size(EndpointType type); // size of the value in bytes, 0 for objects and functions
+
+// A resolved endpoint. Reading and writing values through this doesn't involve any string
+// lookups or comparisons, so this is meant for values that are polled every frame.
+// You get it with Endpoint::handle() after the ODrive is connected and it stays valid
+// until the ODrive is closed.
+// The getters and setters do the same type conversions as the ones in Endpoint. If the type
+// doesn't fit, they return false and set communication_error.
+struct EndpointHandle
+{
+	ODrive* odrive = nullptr;
+	int id = -1;
+	EndpointType type = EndpointType::invalid;
+	u8 size = 0;
+
+	bool is_valid() const { return id != -1; }
+
+	bool set(float value) const;
+	bool set(s32 value) const;
+	bool set(s64 value) const;
+	bool set(bool value) const;
+	bool get(float& value) const;
+	bool get(u8& value) const;
+	bool get(s32& value) const;
+	bool get(s64& value) const;
+	bool get(u64& value) const;
+	bool get(bool& value) const;
+	bool call() const; // Calls a function without parameters and return value
+
+	// Write or read a value of any arithmetic type. It is converted to or from the type of the
+	// endpoint, so this works for every endpoint except objects and functions.
+	template<typename T> bool set_any(T value) const;
+	template<typename T> bool get_any(T& value) const;
+};
+
 class Endpoint
 {
 public:
 	ODrive* odrive = nullptr;
 	int id = -1;
-	std::string name;
-	std::string type;
-	std::string access;
-	std::map<std::string, Endpoint> children;
+	// The strings are stored in the EndpointTable. name is the full path, like ".axis0.error",
+	// short_name is the last part of it.
+	const char* name = "";
+	const char* short_name = "";
+	const char* type = "";
+	const char* access = "none";
+	EndpointType type_enum = EndpointType::invalid;
+	Endpoint* children = nullptr; // sorted by short_name
+	int num_children = 0;
+	// Parameters and return values if this is a function
+	const EndpointHandle* inputs = nullptr;
+	const EndpointHandle* outputs = nullptr;
+	int num_inputs = 0, num_outputs = 0;
 
 public:
 	Endpoint& operator() (const char* name);
 
+	EndpointHandle handle() const;
+
 	bool is_valid() const;
 	bool has_children() const;
 	bool has_child(const char* name) const;
+	// Looks up a descendant by its path relative to this endpoint, like ".axis0.error" or
+	// "axis0.error". Returns nullptr if it doesn't exist.
+	const Endpoint* find(const char* path) const;
 
 	void set(float value) const;
 	void set(s32 value) const;
@@ -48,7 +116,8 @@ public:
 	void get(u64& value) const;
 	void get(bool& value) const;
 
-	// Alternative getter that returns the value directly
+	// Alternative getter that returns the value directly.
+	// This cannot be used between ODrive::pipeline_begin() and pipeline_end().
 	template<typename T>
 	T get2() const
 	{
@@ -59,31 +128,43 @@ public:
 
 
 	// Call a function on ODrive.
-	// You first supply all the parameters, and if the function has a return value, you pass
-	// a pointer to the return value as the last parameter.
+	// You first supply all the parameters, and if the function has return values, you pass
+	// pointers to them after the parameters.
 	// For example, this is how you call a function 'float foo(int)':
 	// float ret;
 	// odrive.root("foo").call(123, &ret);
-	// Every possible parameter/return combination that can be used is defined in ODrive::call;
-	// If you need one that's not there yet, just add it there.
-	// 
-	// About the hack typename in the template parameter list:
-	// It's there to make the odrive expression in the body dependent on the template.
-	// Otherwise the C++ compiler might complain because ODrive isn't defined here yet.
-	// (And the MS compiler will complain otherwise)
-	// Don't set hack to anything when calling this!
-	template<class... Args, typename hack = Endpoint>
-	void call(Args&&... args) const
-	{    
-		if (!has_children() && is_valid() && type == "function")
-		{
-			((hack*)this)->odrive->call(id, std::forward<Args>(args)...);
-			return;
-		}
-		((hack*)this)->odrive->communication_error = true;
-		printf("expected %s to be a function\n", name.c_str());
-	}
+	// Parameters and return values are converted to the types in the json interface.
+	// Writing the parameters, the call itself and reading the return values are pipelined,
+	// so this costs about one round trip. When this is called between ODrive::pipeline_begin()
+	// and pipeline_end(), the return values are only valid after pipeline_end().
+	// The templates are defined in ODrive.h.
+	template<class... Args>
+	void call(const Args&... args) const;
 
 	ODriveVersion get_odrive_fw_version();
 	bool odrive_fw_is_milana(); // Is ODrive flashed with the Milana fw branch?
+
+private:
+	template<typename T> bool call_input(int& index, const T& value) const;
+	template<typename T> bool call_input(int& index, T* const& value) const { return true; }
+	template<typename T> bool call_output(int& index, const T& value) const { return true; }
+	template<typename T> bool call_output(int& index, T* const& value) const;
+};
+
+// All endpoints of an ODrive in a few contiguous arrays, built by parse() from the json
+// interface. The children of an endpoint are next to each other and sorted by name, so
+// looking up a child is a binary search. All strings are stored in one buffer, and type and
+// access strings only once.
+// The json is read in a single pass without building a DOM. Nothing in here may be resized
+// after parse(), because the endpoints point into the arrays.
+struct EndpointTable
+{
+	Endpoint root;
+	std::vector<Endpoint> endpoints;
+	std::vector<EndpointHandle> function_args;
+	std::vector<char> strings;
+
+	// Returns false if the json is invalid.
+	bool parse(const char* json, size_t length, ODrive* odrive);
+	void clear();
 };
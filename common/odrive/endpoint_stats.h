@@ -0,0 +1,80 @@
+// Statistics that the ODrive class collects per endpoint id if ODrive::collect_stats is set.
+// Latencies are stored in a log-linear histogram like HdrHistogram: every power of two is split
+// into 8 buckets, so percentiles are accurate to 12.5% over the whole range without storing
+// every sample.
+#pragma once
+#include "../../common/helper.h"
+#include "../../common/time_helper.h"
+
+struct LatencyHistogram
+{
+	static const int sub_buckets = 8; // per power of two
+	static const int num_buckets = (32-2)*sub_buckets;
+
+	u32 counts[num_buckets] = {};
+	u32 total_count = 0;
+	u64 total_micros = 0;
+	u32_micros max_micros = 0;
+
+	static int bucket(u32_micros micros)
+	{
+		if (micros < sub_buckets)
+			return micros;
+		int exponent = 31;
+		while (!(micros >> exponent))
+			exponent--;
+		return (exponent-2)*sub_buckets + ((micros >> (exponent-3)) & (sub_buckets-1));
+	}
+	static u32_micros bucket_lower_bound(int bucket)
+	{
+		if (bucket < sub_buckets)
+			return bucket;
+		int exponent = bucket/sub_buckets + 2;
+		return (u32_micros)(sub_buckets + bucket%sub_buckets) << (exponent-3);
+	}
+
+	void record(u32_micros micros)
+	{
+		counts[bucket(micros)]++;
+		total_count++;
+		total_micros += micros;
+		if (micros > max_micros)
+			max_micros = micros;
+	}
+
+	u32_micros mean() const { return total_count ? (u32_micros)(total_micros/total_count) : 0; }
+
+	// The smallest latency that fraction of the samples don't exceed, e.g. 0.99 for the 99th
+	// percentile. This returns the upper end of the bucket, so it errs on the slow side.
+	u32_micros percentile(float fraction) const
+	{
+		u64 needed = (u64)(fraction*total_count + 0.5f);
+		if (needed == 0)
+			needed = 1;
+		u64 sum = 0;
+		for (int i = 0; i < num_buckets; i++)
+		{
+			sum += counts[i];
+			if (sum >= needed)
+			{
+				u32_micros upper = i+1 < num_buckets ? bucket_lower_bound(i+1)-1 : 0xffffffff;
+				return upper < max_micros ? upper : max_micros;
+			}
+		}
+		return max_micros;
+	}
+};
+
+struct EndpointStats
+{
+	u32 requests = 0;      // responses that were received
+	u32 resends = 0;       // how often the request was sent again after a timeout
+	u32 timeouts = 0;      // receive timeouts while this was the oldest request in flight
+	u32 receive_again = 0; // duplicate responses to a request that was already done
+	u64 bytes_sent = 0, bytes_received = 0; // fibre packets without UART framing
+
+	// Time from the first send until the response arrived, including all resends.
+	LatencyHistogram latency;
+	u32_micros last_latency = 0;
+	u64_micros last_response_time = 0;
+};
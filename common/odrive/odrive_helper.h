@@ -166,40 +166,57 @@ inline void print_motor_error(s64 error)
 
 inline void check_odrive_errors(Endpoint* root, int& num_errors)
 {
-	s64 error = 0;
+	s64 error = 0, can_error = 0;
+	root->odrive->pipeline_begin();
 	if (!root->odrive_fw_is_milana())
-	{
-		(*root)("error").get(error); if (error) { printf("odrive: error: 0x%llx\n", error); num_errors++; }
-	}
-	(*root)("can")("error").get(error); if (error) { printf("odrive: can error: 0x%llx\n", error); num_errors++; }
+		(*root)("error").get(error);
+	(*root)("can")("error").get(can_error);
+	root->odrive->pipeline_end();
+	if (error) { printf("odrive: error: 0x%llx\n", error); num_errors++; }
+	if (can_error) { printf("odrive: can error: 0x%llx\n", can_error); num_errors++; }
 }
 
 inline void check_axis_errors(Endpoint* axis, const char* axis_name, int& num_errors)
 {
-	s64 error = 0;
-	(*axis)                        ("error").get(error); if (error) { printf("odrive: %s error: 0x%llx ", axis_name, error); print_axis_error(error); printf("\n"); num_errors++; }
+	// All error values are read with one pipelined request.
+	s64 error = 0, fet_thermistor_error = 0, motor_thermistor_error = 0, motor_error = 0;
+	s64 controller_error = 0, encoder_error = 0, sensorless_estimator_error = 0;
+	axis->odrive->pipeline_begin();
+	(*axis)                        ("error").get(error);
 	if (axis->odrive_fw_is_milana())
 	{
-		(*axis)("fet_thermistor")      ("error").get(error); if (error) { printf("odrive: %s fet_thermistor: 0x%llx\n", axis_name, error); num_errors++; }
-		(*axis)("motor_thermistor")    ("error").get(error); if (error) { printf("odrive: %s motor_thermistor: 0x%llx\n", axis_name, error); num_errors++; }
+		(*axis)("fet_thermistor")      ("error").get(fet_thermistor_error);
+		(*axis)("motor_thermistor")    ("error").get(motor_thermistor_error);
 	}
-	(*axis)("motor")               ("error").get(error); if (error) { printf("odrive: %s motor: 0x%llx ", axis_name, error); print_motor_error(error); printf("\n"); num_errors++; }
-	(*axis)("controller")          ("error").get(error); if (error) { printf("odrive: %s controller: 0x%llx\n", axis_name, error); num_errors++; }
-	(*axis)("encoder")             ("error").get(error); if (error) { printf("odrive: %s encoder: 0x%llx\n", axis_name, error); num_errors++; }
-	(*axis)("sensorless_estimator")("error").get(error); if (error) { printf("odrive: %s sensorless_estimator: 0x%llx\n", axis_name, error); num_errors++; }
+	(*axis)("motor")               ("error").get(motor_error);
+	(*axis)("controller")          ("error").get(controller_error);
+	(*axis)("encoder")             ("error").get(encoder_error);
+	(*axis)("sensorless_estimator")("error").get(sensorless_estimator_error);
+	axis->odrive->pipeline_end();
+
+	if (error) { printf("odrive: %s error: 0x%llx ", axis_name, error); print_axis_error(error); printf("\n"); num_errors++; }
+	if (fet_thermistor_error) { printf("odrive: %s fet_thermistor: 0x%llx\n", axis_name, fet_thermistor_error); num_errors++; }
+	if (motor_thermistor_error) { printf("odrive: %s motor_thermistor: 0x%llx\n", axis_name, motor_thermistor_error); num_errors++; }
+	if (motor_error) { printf("odrive: %s motor: 0x%llx ", axis_name, motor_error); print_motor_error(motor_error); printf("\n"); num_errors++; }
+	if (controller_error) { printf("odrive: %s controller: 0x%llx\n", axis_name, controller_error); num_errors++; }
+	if (encoder_error) { printf("odrive: %s encoder: 0x%llx\n", axis_name, encoder_error); num_errors++; }
+	if (sensorless_estimator_error) { printf("odrive: %s sensorless_estimator: 0x%llx\n", axis_name, sensorless_estimator_error); num_errors++; }
 }
 
 inline void clear_odrive_errors(Endpoint* root)
 {
+	root->odrive->pipeline_begin();
 	if (!root->odrive_fw_is_milana())
 	{
 		(*root)("error").set(0);
 	}
 	(*root)("can")("error").set(0);
+	root->odrive->pipeline_end();
 }
 
 inline void clear_axis_errors(Endpoint* axis)
 {
+	axis->odrive->pipeline_begin();
 	(*axis)                        ("error").set(0);
 	if (axis->odrive_fw_is_milana())
 	{
@@ -210,4 +227,5 @@ inline void clear_axis_errors(Endpoint* axis)
 	(*axis)("controller")          ("error").set(0);
 	(*axis)("encoder")             ("error").set(0);
 	(*axis)("sensorless_estimator")("error").set(0);
+	axis->odrive->pipeline_end();
 }
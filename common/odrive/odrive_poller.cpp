@@ -0,0 +1,205 @@
+#include "odrive_poller.h"
+#include <algorithm>
+#include <math.h>
+#include <stdlib.h>
+
+// The frame loads are balanced over this many frames. The frame counter wraps around here, so
+// the intervals are divisors of it, otherwise the reads would be uneven at the wrap.
+static const int schedule_frames = 240;
+
+// The divisor of schedule_frames that is closest to interval, the smaller one on a tie.
+static int schedule_interval(int interval)
+{
+	int best = 1;
+	for (int d = 1; d <= schedule_frames; d++)
+	{
+		if (schedule_frames % d == 0 && abs(d - interval) < abs(best - interval))
+			best = d;
+	}
+	return best;
+}
+
+ODrivePoller::~ODrivePoller()
+{
+	stop();
+}
+
+int ODrivePoller::add(const EndpointHandle& handle, float rate)
+{
+	assert(!is_running());
+	if (!handle.is_valid() || handle.type == EndpointType::function || rate <= 0)
+	{
+		printf("poller: endpoint %d is not a value or the rate %g is invalid\n", handle.id, rate);
+		return -1;
+	}
+	PolledValue v;
+	v.handle = handle;
+	v.rate = rate;
+	v.interval = 1;
+	v.offset = 0;
+	v.is_float = handle.type == EndpointType::float32;
+	values.push_back(v);
+	return (int)values.size()-1;
+}
+
+// Picks the offset of every value so that the number of reads per frame is as even as possible.
+// The values with the highest rate are placed first, each in the offset whose busiest frame
+// has the fewest reads so far.
+void ODrivePoller::schedule()
+{
+	std::vector<int> order(values.size());
+	for (int i = 0; i < (int)values.size(); i++)
+		order[i] = i;
+	std::stable_sort(order.begin(), order.end(), [&](int a, int b) { return values[a].rate > values[b].rate; });
+
+	int load[schedule_frames] = {};
+	for (int i : order)
+	{
+		PolledValue& v = values[i];
+		if (v.rate > frame_rate)
+			printf("poller: %s is read at %g Hz, not %g Hz, because that is the frame rate\n",
+				odrive->endpoint_by_id(v.handle.id)->name, frame_rate, v.rate);
+		int interval = std::max(1, std::min(schedule_frames, (int)lroundf(frame_rate / v.rate)));
+		v.interval = schedule_interval(interval);
+		if (v.interval != interval)
+			printf("poller: %s is read every %d frames (%g Hz), not every %d\n",
+				odrive->endpoint_by_id(v.handle.id)->name, v.interval, frame_rate / v.interval, interval);
+		int best_offset = 0, best_load = -1;
+		for (int offset = 0; offset < v.interval; offset++)
+		{
+			int max_load = 0;
+			for (int frame = offset; frame < schedule_frames; frame += v.interval)
+				max_load = std::max(max_load, load[frame]);
+			if (best_load == -1 || max_load < best_load)
+			{
+				best_offset = offset;
+				best_load = max_load;
+			}
+		}
+		v.offset = best_offset;
+		for (int frame = best_offset; frame < schedule_frames; frame += v.interval)
+			load[frame]++;
+	}
+}
+
+bool ODrivePoller::start(ODrive& odrive, float frame_rate)
+{
+	stop();
+	if (!odrive.is_connected || frame_rate <= 0)
+		return false;
+	this->odrive = &odrive;
+	this->frame_rate = frame_rate;
+	schedule();
+	stop_thread = false;
+	thread = std::thread(&ODrivePoller::thread_main, this);
+	return true;
+}
+
+void ODrivePoller::stop()
+{
+	if (!thread.joinable())
+		return;
+	stop_thread = true;
+	thread.join();
+}
+
+float ODrivePoller::achieved_rate(int index) const
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	if (index < 0 || index >= (int)values.size())
+		return 0;
+	return values[index].achieved_rate;
+}
+
+void ODrivePoller::report_rates(float elapsed_seconds)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	for (PolledValue& v : values)
+	{
+		// A value can't be read more often than once per frame.
+		float target_rate = std::min(v.rate, frame_rate);
+		v.achieved_rate = v.reads / elapsed_seconds;
+		v.reads = 0;
+		if (report_interval > 0 && v.achieved_rate < 0.9f*target_rate)
+			printf("poller: %s was read at %.1f Hz instead of %g Hz\n",
+				odrive->endpoint_by_id(v.handle.id)->name, v.achieved_rate, target_rate);
+	}
+}
+
+void ODrivePoller::thread_main()
+{
+	const u64_micros frame_time = (u64_micros)(1000000 / frame_rate);
+	u64_micros next_frame_time = time_micros_64();
+	u64_micros last_report_time = next_frame_time;
+	// The rates are measured over report_interval, or over 1 second if nothing is printed.
+	const u64_micros report_time = (u64_micros)(std::max(report_interval, 1.0f) * 1000000);
+	u32 frame = 0;
+	std::vector<int> frame_values;
+	// The requests of the control loop go first.
+	odrive->set_background_thread();
+
+	while (!stop_thread)
+	{
+		u64_micros now = time_micros_64();
+		if (now < next_frame_time)
+		{
+			imprecise_sleep((next_frame_time - now) * .000001);
+			continue;
+		}
+		if (now > next_frame_time + frame_time)
+		{
+			// The last frame took too long. Continue from now, the reads that are missed
+			// that way show up in the achieved rates.
+			late_frames++;
+			next_frame_time = now;
+		}
+		next_frame_time += frame_time;
+
+		frame_values.clear();
+		for (int i = 0; i < (int)values.size(); i++)
+		{
+			const PolledValue& v = values[i];
+			if ((frame + schedule_frames - v.offset) % v.interval == 0)
+				frame_values.push_back(i);
+		}
+		frame = (frame+1) % schedule_frames;
+
+		// After a communication error, the values aren't updated anymore until the owner of the
+		// ODrive connects again.
+		if (frame_values.size() && !odrive->communication_error)
+		{
+			odrive->pipeline_begin();
+			for (int i : frame_values)
+			{
+				PolledValue& v = values[i];
+				if (v.is_float)
+					v.handle.get(v.read_float);
+				else
+					v.handle.get_any(v.read_int);
+			}
+			bool ok = odrive->pipeline_end();
+			if (ok)
+			{
+				u64_micros read_time = time_micros_64();
+				std::lock_guard<std::mutex> lock(mutex);
+				for (int i : frame_values)
+				{
+					PolledValue& v = values[i];
+					v.float_value = v.read_float;
+					v.int_value = v.read_int;
+					v.time = read_time;
+					v.valid = true;
+					v.reads++;
+				}
+			}
+		}
+
+		now = time_micros_64();
+		if (now - last_report_time >= report_time)
+		{
+			report_rates((now - last_report_time) * .000001f);
+			last_report_time = now;
+		}
+	}
+	odrive->end_thread();
+}
@@ -0,0 +1,93 @@
+// Reads values from ODrive in the background, each at its own rate, and keeps the last value
+// of each with the time it was read. This is meant for values that are only needed now and then,
+// like the bus voltage for a plot. The control loop gets them from the cache without waiting
+// for ODrive, so they don't add to its frame time:
+//
+// ODrivePoller poller;
+// int vbus_voltage = poller.add(odrive.root("vbus_voltage").handle(), 20); // 20 times per second
+// poller.start(odrive);
+// ...
+// float voltage;
+// poller.get(vbus_voltage, voltage);
+//
+// The thread works in frames of frame_rate per second and each frame is one pipelined batch.
+// A value with rate r is read every frame_rate/r frames, rounded to a divisor of 240, and
+// start() prints the values where that rounding changes the interval. The frames a value is
+// read in are chosen so that every frame gets about the same number of reads. Every
+// report_interval seconds, the values that were read at less than 90% of their rate are
+// printed, for example because the link is too slow for all of them.
+// The thread is a background thread of the ODrive (see ODrive::set_background_thread()), so
+// the requests of the control loop are sent before the polled ones.
+// The ODrive has to stay connected until stop() returns.
+#pragma once
+#include "ODrive.h"
+#include "../../common/time_helper.h"
+#include <thread>
+#include <mutex>
+#include <atomic>
+
+class ODrivePoller
+{
+public:
+	~ODrivePoller();
+
+	// Call this before start(). Returns the index for get() or -1 if the handle is not a value.
+	int add(const EndpointHandle& handle, float rate);
+	bool start(ODrive& odrive, float frame_rate = 100);
+	void stop();
+	bool is_running() const { return thread.joinable(); }
+
+	// The last value that was read and when (time_micros_64()). Returns false if it has not been
+	// read yet. This never waits for ODrive.
+	template<typename T>
+	bool get(int index, T& value, u64_micros* time = nullptr) const
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		if (index < 0 || index >= (int)values.size() || !values[index].valid)
+			return false;
+		const PolledValue& v = values[index];
+		value = v.is_float ? (T)v.float_value : (T)v.int_value;
+		if (time)
+			*time = v.time;
+		return true;
+	}
+	// Reads per second in the last report interval.
+	float achieved_rate(int index) const;
+
+	float report_interval = 10; // seconds, 0 to never print the missed rates
+	std::atomic<u32> late_frames{0}; // frames that started more than one frame too late
+
+private:
+	struct PolledValue
+	{
+		EndpointHandle handle;
+		float rate;
+		int interval; // in frames
+		int offset; // the value is read in the frames where (frame-offset)%interval == 0
+		bool is_float;
+
+		// The last value. Floats are kept as float, all others as s64, like in ConfigValue.
+		bool valid = false;
+		float float_value = 0;
+		s64 int_value = 0;
+		u64_micros time = 0;
+
+		u32 reads = 0; // since the last report
+		float achieved_rate = 0;
+
+		// Written by the thread during the pipeline, copied to the value afterwards.
+		float read_float = 0;
+		s64 read_int = 0;
+	};
+	std::vector<PolledValue> values;
+	mutable std::mutex mutex; // protects the values once the thread is running
+
+	ODrive* odrive = nullptr;
+	float frame_rate = 100;
+	std::thread thread;
+	std::atomic<bool> stop_thread{false};
+
+	void schedule();
+	void thread_main();
+	void report_rates(float elapsed_seconds);
+};
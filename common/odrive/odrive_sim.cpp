@@ -0,0 +1,641 @@
+#include "odrive_sim.h"
+#include "odrive_helper.h"
+#include "json.hpp"
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+
+using nlohmann::json;
+
+// Same as odrive_frequency in common.h
+static const int sim_frequency = 8000;
+
+// All endpoints of the simulated ODrive. Paths that start with "axis." exist once for every axis.
+// Endpoint ids are given out in this order.
+struct SimEndpoint
+{
+	const char* path;
+	const char* type;
+	const char* access;
+	double initial_value;
+};
+static const SimEndpoint sim_endpoints[] =
+{
+	{"error",                   "uint8",    "rw", 0},
+	{"vbus_voltage",            "float",    "r",  24},
+	{"ibus",                    "float",    "r",  0},
+	{"ibus_report_filter_k",    "float",    "rw", 1},
+	{"serial_number",           "uint64",   "r",  35766737464653.0},
+	{"hw_version_major",        "uint8",    "r",  3},
+	{"hw_version_minor",        "uint8",    "r",  6},
+	{"hw_version_variant",      "uint8",    "r",  56},
+	{"fw_version_major",        "uint8",    "r",  0},
+	{"fw_version_minor",        "uint8",    "r",  5},
+	{"fw_version_revision",     "uint8",    "r",  6},
+	{"config.max_regen_current",       "float", "rw", 0},
+	{"config.brake_resistance",        "float", "rw", 2},
+	{"config.dc_max_positive_current", "float", "rw", 10},
+	{"config.dc_max_negative_current", "float", "rw", -0.01},
+	{"can.error",               "uint8",    "rw", 0},
+	{"save_configuration",      "function", "",   0},
+	{"reboot",                  "function", "",   0},
+	{"clear_errors",            "function", "",   0},
+
+	{"axis.error",                     "uint32",   "rw", 0},
+	{"axis.current_state",             "uint8",    "r",  AXIS_STATE_IDLE},
+	{"axis.requested_state",           "uint8",    "rw", 0},
+	{"axis.watchdog_feed",             "function", "",   0},
+	{"axis.config.enable_watchdog",    "bool",     "rw", 0},
+	{"axis.config.watchdog_timeout",   "float",    "rw", 0},
+	{"axis.motor.error",               "uint64",   "rw", 0},
+	{"axis.motor.is_calibrated",       "bool",     "r",  1},
+	{"axis.motor.current_control.Iq_setpoint",    "float", "r",  0},
+	{"axis.motor.config.pre_calibrated",          "bool",  "rw", 1},
+	{"axis.motor.config.pole_pairs",              "int32", "rw", 7},
+	{"axis.motor.config.torque_constant",         "float", "rw", 0.04},
+	{"axis.motor.config.current_lim",             "float", "rw", 10},
+	{"axis.motor.config.current_lim_margin",      "float", "rw", 8},
+	{"axis.motor.config.requested_current_range", "float", "rw", 60},
+	{"axis.controller.error",          "uint8",    "rw", 0},
+	{"axis.controller.input_pos",      "float",    "rw", 0},
+	{"axis.controller.input_vel",      "float",    "rw", 0},
+	{"axis.controller.input_torque",   "float",    "rw", 0},
+	{"axis.controller.anticogging_valid",          "bool",  "r",  0},
+	{"axis.controller.config.control_mode",        "uint8", "rw", CONTROL_MODE_POSITION_CONTROL},
+	{"axis.controller.config.input_mode",          "uint8", "rw", INPUT_MODE_PASSTHROUGH},
+	{"axis.controller.config.pos_gain",            "float", "rw", 20},
+	{"axis.controller.config.vel_gain",            "float", "rw", 0.16},
+	{"axis.controller.config.vel_integrator_gain", "float", "rw", 0.32},
+	{"axis.controller.config.vel_limit",           "float", "rw", 2},
+	{"axis.controller.config.vel_limit_tolerance", "float", "rw", 1.2},
+	{"axis.controller.config.input_filter_bandwidth",          "float", "rw", 2},
+	{"axis.controller.config.anticogging.anticogging_enabled", "bool",  "rw", 1},
+	{"axis.controller.config.enable_vel_limit",       "bool", "rw", 1},
+	{"axis.controller.config.enable_overspeed_error", "bool", "rw", 1},
+	{"axis.encoder.error",             "uint32",   "rw", 0},
+	{"axis.encoder.is_ready",          "bool",     "r",  1},
+	{"axis.encoder.index_found",       "bool",     "r",  0},
+	{"axis.encoder.shadow_count",      "int32",    "r",  0},
+	{"axis.encoder.pos_estimate",      "float",    "r",  0},
+	{"axis.encoder.vel_estimate",      "float",    "r",  0},
+	{"axis.encoder.config.mode",                "uint16", "rw", ENCODER_MODE_INCREMENTAL},
+	{"axis.encoder.config.use_index",           "bool",   "rw", 0},
+	{"axis.encoder.config.pre_calibrated",      "bool",   "rw", 0},
+	{"axis.encoder.config.cpr",                 "int32",  "rw", 8192},
+	{"axis.encoder.config.bandwidth",           "float",  "rw", 1000},
+	{"axis.encoder.config.abs_spi_cs_gpio_pin", "uint16", "rw", 1},
+	{"axis.sensorless_estimator.error",         "uint8",  "rw", 0},
+};
+
+// Model constants
+static const float sim_inertia = 0.002f; // Nm per turn/s^2
+static const float sim_friction = 0.01f; // Nm per turn/s
+
+static json& get_member_list(json& members, const std::string& name)
+{
+	for (json& obj : members)
+	{
+		if (obj["name"] == name)
+			return obj["members"];
+	}
+	members.push_back({{"name", name}, {"type", "object"}, {"members", json::array()}});
+	return members.back()["members"];
+}
+
+ODriveSim::ODriveSim()
+{
+	json root = json::array();
+	values.push_back(Value()); // id 0 is the json endpoint
+	for (int a = -1; a < num_axes; a++)
+	{
+		for (const SimEndpoint& e : sim_endpoints)
+		{
+			std::string path = e.path;
+			bool is_axis = path.compare(0, 5, "axis.") == 0;
+			if (is_axis != (a != -1))
+				continue;
+			if (is_axis)
+				path.replace(0, 4, "axis" + std::to_string(a));
+
+			Value v;
+			v.type = endpoint_type_from_string(e.type);
+			v.writable = strchr(e.access, 'w') != nullptr;
+			memset(v.bytes, 0, sizeof(v.bytes));
+			int endpoint_id = (int)values.size();
+			values.push_back(v);
+			ids[path] = endpoint_id;
+			if (v.type == EndpointType::float32)
+				set_float(endpoint_id, (float)e.initial_value);
+			else
+				set_int(endpoint_id, (s64)e.initial_value);
+
+			json* members = &root;
+			size_t start = 0, dot;
+			while ((dot = path.find('.', start)) != std::string::npos)
+			{
+				members = &get_member_list(*members, path.substr(start, dot-start));
+				start = dot+1;
+			}
+			json obj = {{"name", path.substr(start)}, {"id", endpoint_id}, {"type", e.type}};
+			if (v.type == EndpointType::function)
+			{
+				obj["inputs"] = json::array();
+				obj["outputs"] = json::array();
+			}
+			else
+				obj["access"] = e.access;
+			members->push_back(obj);
+		}
+	}
+	// A function with arguments, like get_oscilloscope_val of the firmware. The arguments are
+	// endpoints of their own. There is no oscilloscope, so it returns the index.
+	{
+		const EndpointType types[] = {EndpointType::function, EndpointType::uint32, EndpointType::float32};
+		const char* paths[] = {"get_oscilloscope_val", "get_oscilloscope_val.index", "get_oscilloscope_val.val"};
+		for (int i = 0; i < 3; i++)
+		{
+			Value v;
+			v.type = types[i];
+			v.writable = i == 1;
+			memset(v.bytes, 0, sizeof(v.bytes));
+			ids[paths[i]] = (int)values.size();
+			values.push_back(v);
+		}
+		int function_id = ids["get_oscilloscope_val"];
+		json index = {{"name", "index"}, {"id", function_id+1}, {"type", "uint32"}, {"access", "rw"}};
+		json val = {{"name", "val"}, {"id", function_id+2}, {"type", "float"}, {"access", "r"}};
+		root.push_back({{"name", "get_oscilloscope_val"}, {"id", function_id}, {"type", "function"},
+			{"inputs", json::array({index})}, {"outputs", json::array({val})}});
+	}
+	json_interface = root.dump();
+	initial_values = values;
+
+	// The json id just has to change when the json changes, so a simple hash is enough here.
+	json_id = 2166136261u;
+	for (char c : json_interface)
+		json_id = (json_id ^ (u8)c) * 16777619u;
+
+	vbus_voltage_id = id("vbus_voltage");
+	ibus_id         = id("ibus");
+	reboot_id       = id("reboot");
+	clear_errors_id = id("clear_errors");
+	oscilloscope_val_id = id("get_oscilloscope_val");
+	for (int a = 0; a < num_axes; a++)
+	{
+		const std::string prefix = "axis" + std::to_string(a) + ".";
+		AxisIds& e = axis_ids[a];
+		e.error                  = id(prefix + "error");
+		e.current_state          = id(prefix + "current_state");
+		e.requested_state        = id(prefix + "requested_state");
+		e.watchdog_feed          = id(prefix + "watchdog_feed");
+		e.enable_watchdog        = id(prefix + "config.enable_watchdog");
+		e.watchdog_timeout       = id(prefix + "config.watchdog_timeout");
+		e.motor_is_calibrated    = id(prefix + "motor.is_calibrated");
+		e.Iq_setpoint            = id(prefix + "motor.current_control.Iq_setpoint");
+		e.torque_constant        = id(prefix + "motor.config.torque_constant");
+		e.current_lim            = id(prefix + "motor.config.current_lim");
+		e.controller_error       = id(prefix + "controller.error");
+		e.input_pos              = id(prefix + "controller.input_pos");
+		e.input_vel              = id(prefix + "controller.input_vel");
+		e.input_torque           = id(prefix + "controller.input_torque");
+		e.control_mode           = id(prefix + "controller.config.control_mode");
+		e.pos_gain               = id(prefix + "controller.config.pos_gain");
+		e.vel_gain               = id(prefix + "controller.config.vel_gain");
+		e.vel_integrator_gain    = id(prefix + "controller.config.vel_integrator_gain");
+		e.vel_limit              = id(prefix + "controller.config.vel_limit");
+		e.vel_limit_tolerance    = id(prefix + "controller.config.vel_limit_tolerance");
+		e.enable_vel_limit       = id(prefix + "controller.config.enable_vel_limit");
+		e.enable_overspeed_error = id(prefix + "controller.config.enable_overspeed_error");
+		e.encoder_is_ready       = id(prefix + "encoder.is_ready");
+		e.index_found            = id(prefix + "encoder.index_found");
+		e.shadow_count           = id(prefix + "encoder.shadow_count");
+		e.pos_estimate           = id(prefix + "encoder.pos_estimate");
+		e.vel_estimate           = id(prefix + "encoder.vel_estimate");
+		e.cpr                    = id(prefix + "encoder.config.cpr");
+	}
+}
+
+int ODriveSim::id(const std::string& path) const
+{
+	auto it = ids.find(path);
+	assert(it != ids.end());
+	return it->second;
+}
+
+float ODriveSim::get_float(int id) const
+{
+	float value;
+	memcpy(&value, values[id].bytes, sizeof(value));
+	return value;
+}
+
+s64 ODriveSim::get_int(int id) const
+{
+	const Value& v = values[id];
+	const u8* b = v.bytes;
+	switch (v.type)
+	{
+	case EndpointType::boolean:
+	case EndpointType::uint8:  return *(const u8*)b;
+	case EndpointType::int8:   return *(const s8*)b;
+	case EndpointType::uint16: { u16 x; memcpy(&x, b, 2); return x; }
+	case EndpointType::int16:  { s16 x; memcpy(&x, b, 2); return x; }
+	case EndpointType::uint32: { u32 x; memcpy(&x, b, 4); return x; }
+	case EndpointType::int32:  { s32 x; memcpy(&x, b, 4); return x; }
+	case EndpointType::uint64:
+	case EndpointType::int64:  { s64 x; memcpy(&x, b, 8); return x; }
+	default: return 0;
+	}
+}
+
+void ODriveSim::set_float(int id, float value)
+{
+	memcpy(values[id].bytes, &value, sizeof(value));
+}
+
+void ODriveSim::set_int(int id, s64 value)
+{
+	// Values are little endian on the wire, so the lower bytes of the s64 are the value.
+	Value& v = values[id];
+	memcpy(v.bytes, &value, endpoint_type_size(v.type));
+}
+
+bool ODriveSim::lose_packet()
+{
+	if (packet_loss <= 0)
+		return false;
+	return std::uniform_real_distribution<float>(0, 1)(rng) < packet_loss;
+}
+
+static u16 read_u16(const u8* data)
+{
+	return (u16)(data[0] | (data[1] << 8));
+}
+
+void ODriveSim::handle_packet(const u8* packet, int length, u64_micros now)
+{
+	if (length < 8)
+		return;
+	requests_handled++;
+	if (lose_packet())
+	{
+		packets_dropped++;
+		return;
+	}
+	step_model(now);
+
+	u16 seq_no        = read_u16(packet);
+	u16 endpoint_id   = read_u16(packet+2);
+	u16 response_size = read_u16(packet+4);
+	const u8* payload = packet+6;
+	int payload_length = length-8;
+	u16 trailer = read_u16(packet+length-2);
+	int id = endpoint_id & 0x7fff;
+
+	Response r;
+	r.due_time = now + latency;
+	r.data[0] = (u8)seq_no;
+	r.data[1] = (u8)((seq_no >> 8) | 0x80);
+	r.length = 2;
+	int max_response = std::min((int)response_size, (int)sizeof(r.data)-2);
+
+	if (id == 0)
+	{
+		if (trailer != 1 || payload_length < 4)
+			return;
+		u32 offset;
+		memcpy(&offset, payload, 4);
+		if (offset == 0xffffffff)
+		{
+			memcpy(r.data+2, &json_id, std::min(4, max_response));
+			r.length += std::min(4, max_response);
+		}
+		else if (offset < json_interface.size())
+		{
+			int n = std::min(max_response, (int)(json_interface.size()-offset));
+			memcpy(r.data+2, json_interface.data()+offset, n);
+			r.length += n;
+		}
+	}
+	else
+	{
+		// Like the real device, requests for another version of the interface are ignored.
+		if (trailer != (u16)(json_id >> 16) || id >= (int)values.size())
+			return;
+		Value& v = values[id];
+		if (v.type == EndpointType::function)
+			call_function(id, now);
+		else
+		{
+			int size = endpoint_type_size(v.type);
+			if (payload_length >= size && v.writable)
+				memcpy(v.bytes, payload, size);
+			int n = std::min(size, max_response);
+			memcpy(r.data+2, v.bytes, n);
+			r.length += n;
+		}
+	}
+
+	if (!(endpoint_id & 0x8000))
+		return;
+	if (lose_packet())
+	{
+		packets_dropped++;
+		return;
+	}
+	responses.push_back(r);
+}
+
+void ODriveSim::queue_ascii_response(const char* text, u64_micros now)
+{
+	Response r;
+	r.due_time = now + latency;
+	r.length = std::min((int)strlen(text), (int)sizeof(r.data)-1);
+	memcpy(r.data, text, r.length);
+	r.data[r.length++] = '\n';
+	responses.push_back(r);
+}
+
+std::string ODriveSim::format_value(int id) const
+{
+	char text[32];
+	if (values[id].type == EndpointType::float32)
+		snprintf(text, sizeof(text), "%f", get_float(id));
+	else if (values[id].type == EndpointType::uint64)
+		snprintf(text, sizeof(text), "%llu", (unsigned long long)get_int(id));
+	else
+		snprintf(text, sizeof(text), "%lld", (long long)get_int(id));
+	return text;
+}
+
+void ODriveSim::handle_ascii_line(const char* line, u64_micros now)
+{
+	requests_handled++;
+	step_model(now);
+
+	char command[8] = "", path[128] = "";
+	double value = 0;
+	int axis = -1;
+	if (sscanf(line, "%7s", command) != 1)
+		return;
+	if (strcmp(command, "r") == 0 || strcmp(command, "w") == 0)
+	{
+		bool write = command[0] == 'w';
+		int n = sscanf(line+1, "%127s %lf", path, &value);
+		if (n < 1 || (write && n < 2))
+		{
+			queue_ascii_response("invalid command format", now);
+			return;
+		}
+		auto it = ids.find(path);
+		if (it == ids.end() || values[it->second].type == EndpointType::function)
+		{
+			queue_ascii_response("invalid property", now);
+			return;
+		}
+		int id = it->second;
+		if (!write)
+		{
+			queue_ascii_response(format_value(id).c_str(), now);
+			return;
+		}
+		// Like the firmware, writes are not acknowledged.
+		if (!values[id].writable)
+			return;
+		if (values[id].type == EndpointType::float32)
+			set_float(id, (float)value);
+		else
+			set_int(id, (s64)value);
+		return;
+	}
+
+	// The axis commands. Their optional feed forward values are ignored here.
+	bool is_setpoint = strcmp(command, "p") == 0 || strcmp(command, "v") == 0 || strcmp(command, "c") == 0;
+	if (is_setpoint || strcmp(command, "f") == 0 || strcmp(command, "u") == 0)
+	{
+		int n = sscanf(line+1, "%d %lf", &axis, &value);
+		if (n < 1 || (is_setpoint && n < 2))
+		{
+			queue_ascii_response("invalid command format", now);
+			return;
+		}
+		if (axis < 0 || axis >= num_axes)
+		{
+			char text[32];
+			snprintf(text, sizeof(text), "invalid motor %d", axis);
+			queue_ascii_response(text, now);
+			return;
+		}
+		const AxisIds& e = axis_ids[axis];
+		if (command[0] == 'f')
+		{
+			std::string text = format_value(e.pos_estimate) + " " + format_value(e.vel_estimate);
+			queue_ascii_response(text.c_str(), now);
+			return;
+		}
+		if (command[0] == 'p')
+		{
+			set_int(e.control_mode, CONTROL_MODE_POSITION_CONTROL);
+			set_float(e.input_pos, (float)value);
+		}
+		else if (command[0] == 'v')
+		{
+			set_int(e.control_mode, CONTROL_MODE_VELOCITY_CONTROL);
+			set_float(e.input_vel, (float)value);
+		}
+		else if (command[0] == 'c')
+		{
+			set_int(e.control_mode, CONTROL_MODE_TORQUE_CONTROL);
+			set_float(e.input_torque, (float)value);
+		}
+		// All of them feed the watchdog.
+		call_function(e.watchdog_feed, now);
+		return;
+	}
+
+	if (strcmp(command, "sr") == 0)
+		call_function(reboot_id, now);
+	else if (strcmp(command, "sc") == 0)
+		call_function(clear_errors_id, now);
+	else if (strcmp(command, "ss") != 0 && strcmp(command, "se") != 0)
+		queue_ascii_response("unknown command", now);
+}
+
+bool ODriveSim::receive_response(u8* packet, int max_length, int* length, u64_micros now)
+{
+	if (responses.empty() || responses.front().due_time > now)
+		return false;
+	const Response& r = responses.front();
+	*length = std::min(r.length, max_length);
+	memcpy(packet, r.data, *length);
+	responses.pop_front();
+	return true;
+}
+
+u64_micros ODriveSim::next_response_time() const
+{
+	return responses.empty() ? 0 : responses.front().due_time;
+}
+
+void ODriveSim::call_function(int function_id, u64_micros now)
+{
+	for (int a = 0; a < num_axes; a++)
+	{
+		if (function_id == axis_ids[a].watchdog_feed)
+			axes[a].last_watchdog_feed = now;
+	}
+	if (function_id == reboot_id)
+	{
+		// Everything except the motor positions starts from scratch.
+		values = initial_values;
+		for (int a = 0; a < num_axes; a++)
+		{
+			axes[a].vel = 0;
+			axes[a].vel_integrator = 0;
+		}
+	}
+	if (function_id == oscilloscope_val_id)
+		set_float(oscilloscope_val_id+2, (float)get_int(oscilloscope_val_id+1));
+	if (function_id == clear_errors_id)
+	{
+		for (auto& it : ids)
+		{
+			const std::string& path = it.first;
+			if (path.size() >= 5 && path.compare(path.size()-5, 5, "error") == 0)
+				set_int(it.second, 0);
+		}
+	}
+}
+
+void ODriveSim::step_model(u64_micros now)
+{
+	const u64_micros step = 1000000 / sim_frequency;
+	if (model_time == 0 || now - model_time > 1000000)
+	{
+		// Don't try to catch up after long pauses.
+		model_time = now;
+		return;
+	}
+	const float dt = 1.0f / sim_frequency;
+	while (model_time + step <= now)
+	{
+		model_time += step;
+		float power = 0;
+		for (int a = 0; a < num_axes; a++)
+		{
+			step_axis(a, dt, model_time);
+			const AxisIds& e = axis_ids[a];
+			float torque = get_float(e.Iq_setpoint) * get_float(e.torque_constant);
+			power += torque * axes[a].vel * 2*3.14159265f;
+		}
+		float vbus = 24.0f - 0.002f*power;
+		set_float(vbus_voltage_id, vbus);
+		set_float(ibus_id, power / vbus);
+	}
+}
+
+void ODriveSim::step_axis(int a, float dt, u64_micros now)
+{
+	AxisState& s = axes[a];
+	const AxisIds& e = axis_ids[a];
+
+	s64 axis_error = get_int(e.error);
+	s64 state = get_int(e.current_state);
+
+	s64 requested_state = get_int(e.requested_state);
+	if (requested_state != 0)
+	{
+		// Calibrations and the index search finish immediately.
+		switch (requested_state)
+		{
+		case AXIS_STATE_CLOSED_LOOP_CONTROL:
+			if (axis_error == 0 && get_int(e.motor_is_calibrated) && get_int(e.encoder_is_ready))
+			{
+				state = AXIS_STATE_CLOSED_LOOP_CONTROL;
+				s.vel_integrator = 0;
+			}
+			else
+				axis_error |= AXIS_ERROR_INVALID_STATE;
+			break;
+		case AXIS_STATE_FULL_CALIBRATION_SEQUENCE:
+		case AXIS_STATE_MOTOR_CALIBRATION:
+			set_int(e.motor_is_calibrated, 1);
+			if (requested_state == AXIS_STATE_FULL_CALIBRATION_SEQUENCE)
+				set_int(e.encoder_is_ready, 1);
+			state = AXIS_STATE_IDLE;
+			break;
+		case AXIS_STATE_ENCODER_INDEX_SEARCH:
+			set_int(e.index_found, 1);
+			set_int(e.encoder_is_ready, 1);
+			state = AXIS_STATE_IDLE;
+			break;
+		case AXIS_STATE_ENCODER_OFFSET_CALIBRATION:
+			set_int(e.encoder_is_ready, 1);
+			state = AXIS_STATE_IDLE;
+			break;
+		default:
+			state = AXIS_STATE_IDLE;
+			break;
+		}
+		set_int(e.requested_state, 0);
+	}
+
+	if (get_int(e.enable_watchdog) &&
+		(float)(now - s.last_watchdog_feed) * 1e-6f > get_float(e.watchdog_timeout))
+	{
+		axis_error |= AXIS_ERROR_WATCHDOG_TIMER_EXPIRED;
+	}
+
+	float Iq = 0;
+	if (state == AXIS_STATE_CLOSED_LOOP_CONTROL && axis_error == 0)
+	{
+		float torque = 0;
+		s64 control_mode = get_int(e.control_mode);
+		float vel_limit = get_float(e.vel_limit);
+		if (control_mode == CONTROL_MODE_TORQUE_CONTROL)
+			torque = get_float(e.input_torque);
+		else if (control_mode != CONTROL_MODE_VOLTAGE_CONTROL)
+		{
+			float vel_setpoint = get_float(e.input_vel);
+			if (control_mode == CONTROL_MODE_POSITION_CONTROL)
+				vel_setpoint += get_float(e.pos_gain) * (get_float(e.input_pos) - s.pos);
+			if (get_int(e.enable_vel_limit))
+				vel_setpoint = std::max(-vel_limit, std::min(vel_limit, vel_setpoint));
+			float vel_error = vel_setpoint - s.vel;
+			s.vel_integrator += get_float(e.vel_integrator_gain) * vel_error * dt;
+			torque = get_float(e.vel_gain) * vel_error + s.vel_integrator;
+		}
+		float torque_constant = get_float(e.torque_constant);
+		float current_lim = get_float(e.current_lim);
+		Iq = torque_constant > 0 ? torque / torque_constant : 0;
+		Iq = std::max(-current_lim, std::min(current_lim, Iq));
+
+		if (get_int(e.enable_overspeed_error) &&
+			std::abs(s.vel) > vel_limit * get_float(e.vel_limit_tolerance))
+		{
+			set_int(e.controller_error, get_int(e.controller_error) | 1); // CONTROLLER_ERROR_OVERSPEED
+			axis_error |= AXIS_ERROR_CONTROLLER_FAILED;
+		}
+	}
+	else
+	{
+		s.vel_integrator = 0;
+	}
+	if (axis_error)
+	{
+		state = AXIS_STATE_IDLE;
+		Iq = 0;
+	}
+
+	float torque = Iq * get_float(e.torque_constant);
+	float acceleration = (torque - sim_friction * s.vel) / sim_inertia;
+	s.vel += acceleration * dt;
+	s.pos += s.vel * dt;
+
+	set_int(e.error, axis_error);
+	set_int(e.current_state, state);
+	set_float(e.Iq_setpoint, Iq);
+	set_float(e.pos_estimate, s.pos);
+	set_float(e.vel_estimate, s.vel);
+	set_int(e.shadow_count, (s64)std::floor(s.pos * (float)get_int(e.cpr)));
+}
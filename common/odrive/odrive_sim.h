@@ -0,0 +1,105 @@
+// A simulated ODrive that runs in the same process.
+// It serves a json interface that looks like the one of the stock firmware 0.5.6 and answers
+// fibre requests by endpoint id, just like the real device. Behind the endpoints there is a
+// simple model of motor, encoder and controller, which is stepped with odrive_frequency.
+// The model is only advanced when requests come in, so nothing runs in the background.
+//
+// ODrive::connect_sim() uses this as a transport. This makes it possible to run the proxy and
+// control_ui without hardware, for example to measure the loop rate or to test reconnects.
+// Latency and packet loss can be set to make it behave more like a real connection. The loss
+// is decided by a seeded random generator, so a run can be repeated exactly.
+#pragma once
+#include "endpoint.h"
+#include "../../common/time_helper.h"
+#include <string>
+#include <vector>
+#include <deque>
+#include <map>
+#include <random>
+
+class ODriveSim
+{
+public:
+	ODriveSim();
+
+	// Time from receiving a request until the response is available.
+	u32_micros latency = 200;
+	// Probability that a request or a response gets lost, between 0 and 1.
+	float packet_loss = 0;
+	void set_seed(u32 seed) { rng.seed(seed); }
+
+	// Handles one fibre packet. The response is queued and can be taken out with
+	// receive_response() after the latency has passed.
+	void handle_packet(const u8* packet, int length, u64_micros now);
+	// Handles one line of the ASCII protocol (without the newline): r, w, f, u, p, v, c and the
+	// system commands ss, se, sr and sc. Responses are queued as text lines like the ones of
+	// handle_packet(). Lines are never lost, packet_loss only applies to fibre packets.
+	void handle_ascii_line(const char* line, u64_micros now);
+	// Returns false if no response is due yet.
+	bool receive_response(u8* packet, int max_length, int* length, u64_micros now);
+	// When the next response is due, or 0 if none is queued.
+	u64_micros next_response_time() const;
+
+	const std::string& get_json() const { return json_interface; }
+
+	int requests_handled = 0;
+	int packets_dropped = 0;
+
+private:
+	struct Value
+	{
+		EndpointType type;
+		bool writable;
+		u8 bytes[8];
+	};
+	std::vector<Value> values; // indexed by endpoint id, 0 is the json endpoint
+	std::vector<Value> initial_values; // restored on reboot
+	std::map<std::string, int> ids;
+	std::string json_interface;
+	u32 json_id;
+
+	struct Response
+	{
+		u64_micros due_time;
+		int length;
+		u8 data[64];
+	};
+	std::deque<Response> responses;
+
+	std::mt19937 rng;
+	bool lose_packet();
+
+	// The model. The ids of the endpoints it uses are looked up once in the constructor.
+	struct AxisIds
+	{
+		int error, current_state, requested_state;
+		int watchdog_feed, enable_watchdog, watchdog_timeout;
+		int motor_is_calibrated, Iq_setpoint, torque_constant, current_lim;
+		int controller_error, input_pos, input_vel, input_torque;
+		int control_mode, pos_gain, vel_gain, vel_integrator_gain;
+		int vel_limit, vel_limit_tolerance, enable_vel_limit, enable_overspeed_error;
+		int encoder_is_ready, index_found, shadow_count, pos_estimate, vel_estimate, cpr;
+	};
+	struct AxisState
+	{
+		float pos = 0, vel = 0;
+		float vel_integrator = 0;
+		u64_micros last_watchdog_feed = 0;
+	};
+	static const int num_axes = 2;
+	AxisIds axis_ids[num_axes];
+	AxisState axes[num_axes];
+	int vbus_voltage_id, ibus_id, reboot_id, clear_errors_id, oscilloscope_val_id;
+	u64_micros model_time = 0;
+	void step_model(u64_micros now);
+	void step_axis(int a, float dt, u64_micros now);
+	void call_function(int id, u64_micros now);
+	void queue_ascii_response(const char* text, u64_micros now);
+	std::string format_value(int id) const;
+
+	int id(const std::string& path) const;
+	float get_float(int id) const;
+	s64 get_int(int id) const;
+	void set_float(int id, float value);
+	void set_int(int id, s64 value);
+};
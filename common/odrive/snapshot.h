@@ -0,0 +1,121 @@
+// A fixed set of values that are always read together, like the feedback of an axis that is
+// polled every frame. The paths are resolved once and each read() queues all of them back to
+// back in one pipeline. The responses are deserialized straight into the values, there are no
+// lookups and no intermediate buffers. For example:
+//
+// Snapshot<float, float, float> feedback;
+// feedback.resolve(odrive.root("axis0"), {"encoder.pos_estimate", "encoder.vel_estimate",
+//	"motor.current_control.Iq_setpoint"});
+// feedback.read();
+// float pos = feedback.get<0>();
+//
+// get(pos, vel, iq) reads into other variables instead. Both can be used between
+// ODrive::pipeline_begin() and pipeline_end(), then the reads are part of that batch.
+#pragma once
+#include "ODrive.h"
+#include <tuple>
+#include <utility>
+
+// The endpoint type that is transmitted as T, or invalid if there is none.
+template<typename T>
+constexpr EndpointType endpoint_type_of()
+{
+	return std::is_same<T, bool>::value  ? EndpointType::boolean :
+		std::is_same<T, u8>::value    ? EndpointType::uint8 :
+		std::is_same<T, s8>::value    ? EndpointType::int8 :
+		std::is_same<T, u16>::value   ? EndpointType::uint16 :
+		std::is_same<T, s16>::value   ? EndpointType::int16 :
+		std::is_same<T, u32>::value   ? EndpointType::uint32 :
+		std::is_same<T, s32>::value   ? EndpointType::int32 :
+		std::is_same<T, u64>::value   ? EndpointType::uint64 :
+		std::is_same<T, s64>::value   ? EndpointType::int64 :
+		std::is_same<T, float>::value ? EndpointType::float32 :
+		EndpointType::invalid;
+}
+
+template<typename... Ts>
+class Snapshot
+{
+public:
+	static const int size = (int)sizeof...(Ts);
+	static_assert(sizeof...(Ts) > 0, "a snapshot needs at least one value");
+
+	std::tuple<Ts...> values;
+
+	// Looks up the paths relative to base, in the order of the types. Returns false and prints
+	// the path if one of them is not a value. Reading such a snapshot sets communication_error.
+	bool resolve(const Endpoint& base, const char* const (&paths)[sizeof...(Ts)])
+	{
+		static const EndpointType types[] = {endpoint_type_of<Ts>()...};
+		odrive = base.odrive;
+		bool ok = true;
+		for (int i = 0; i < size; i++)
+		{
+			const Endpoint* endpoint = base.find(paths[i]);
+			handles[i] = endpoint ? endpoint->handle() : EndpointHandle();
+			handles[i].odrive = odrive;
+			if (!handles[i].is_valid() || handles[i].type == EndpointType::function)
+			{
+				printf("odrive: cannot find the value %s in %s!\n", paths[i], base.name[0] ? base.name : "root");
+				handles[i].id = -1;
+				ok = false;
+			}
+			// Values of the same type are read without the switch in EndpointHandle::get_any().
+			exact_type[i] = handles[i].type == types[i];
+		}
+		return ok;
+	}
+	bool is_resolved() const { return odrive != nullptr; }
+
+	// Reads all values into values. Returns false on communication error.
+	bool read()
+	{
+		return read_into(std::index_sequence_for<Ts...>());
+	}
+	template<int I>
+	const typename std::tuple_element<I, std::tuple<Ts...>>::type& get() const
+	{
+		return std::get<I>(values);
+	}
+
+	// Reads all values into the variables, which must stay valid until the pipeline ends.
+	bool get(Ts&... out) const
+	{
+		assert(is_resolved());
+		odrive->pipeline_begin();
+		int index = 0;
+		// Like in Endpoint::call(), the array initializer expands the parameter pack in order.
+		int expand[] = {0, (get_one(index++, out), 0)...};
+		(void)expand;
+		return odrive->pipeline_end();
+	}
+
+private:
+	ODrive* odrive = nullptr;
+	EndpointHandle handles[sizeof...(Ts)];
+	bool exact_type[sizeof...(Ts)] = {};
+
+	template<size_t... I>
+	bool read_into(std::index_sequence<I...>)
+	{
+		return get(std::get<I>(values)...);
+	}
+	template<typename T>
+	void get_one(int index, T& value) const
+	{
+		get_one(index, value, std::integral_constant<bool, endpoint_type_of<T>() != EndpointType::invalid>());
+	}
+	template<typename T>
+	void get_one(int index, T& value, std::true_type /*is_wire_type*/) const
+	{
+		if (exact_type[index])
+			odrive->get_value(handles[index].id, value);
+		else
+			handles[index].get_any(value);
+	}
+	template<typename T>
+	void get_one(int index, T& value, std::false_type /*is_wire_type*/) const
+	{
+		handles[index].get_any(value);
+	}
+};
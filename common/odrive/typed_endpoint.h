@@ -0,0 +1,59 @@
+// Endpoints whose id and type are known at compile time. endpoint_codegen generates a header
+// with one of these for every endpoint of a json interface that was saved with
+// ODrive::json_cache_folder, for example:
+// constexpr TypedEndpoint<float, 123, json_crc> pos_estimate = {".axis0.encoder.pos_estimate"};
+// which is used like this:
+// float pos = ep::axis0::encoder::pos_estimate.get2(odrive);
+// If the connected ODrive has the same json crc, this is the same as odrive.get_value(123, pos),
+// so there is no lookup and no switch over the type. Otherwise the endpoint is looked up by
+// its path on first use and the value is converted like EndpointHandle::get_any() does.
+#pragma once
+#include "ODrive.h"
+
+template<typename T, int ID, u32 JSON_CRC>
+struct TypedEndpoint
+{
+	const char* path;
+
+	static const int id = ID;
+
+	void set(ODrive& odrive, const T& value) const
+	{
+		if (odrive.get_json_crc() == JSON_CRC)
+			odrive.set_value(ID, value);
+		else
+			odrive.typed_fallback_handle(ID, path).set_any(value);
+	}
+	void get(ODrive& odrive, T& value) const
+	{
+		if (odrive.get_json_crc() == JSON_CRC)
+			odrive.get_value(ID, value);
+		else
+			odrive.typed_fallback_handle(ID, path).get_any(value);
+	}
+	// Like Endpoint::get2(), this cannot be used between ODrive::pipeline_begin() and pipeline_end().
+	T get2(ODrive& odrive) const
+	{
+		T value = T();
+		get(odrive, value);
+		return value;
+	}
+};
+
+// A function without parameters and return values. Functions with parameters are not
+// generated, those are called with Endpoint::call().
+template<int ID, u32 JSON_CRC>
+struct TypedFunction
+{
+	const char* path;
+
+	static const int id = ID;
+
+	void call(ODrive& odrive) const
+	{
+		if (odrive.get_json_crc() == JSON_CRC)
+			odrive.call(ID);
+		else
+			odrive.typed_fallback_handle(ID, path).call();
+	}
+};
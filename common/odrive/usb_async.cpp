@@ -0,0 +1,254 @@
+#include "usb_async.h"
+
+#ifdef ODRIVE_INCLUDE_USB
+#ifdef _MSC_VER
+#include "../../3rdparty/libusb/include/libusb.h"
+#else
+#include <libusb-1.0/libusb.h>
+#endif
+#include <chrono>
+#include <string.h>
+
+static void LIBUSB_CALL on_in_transfer_done(libusb_transfer* transfer)
+{
+	((UsbAsyncTransport*)transfer->user_data)->in_transfer_done(transfer);
+}
+
+static void LIBUSB_CALL on_out_transfer_done(libusb_transfer* transfer)
+{
+	((UsbAsyncTransport*)transfer->user_data)->out_transfer_done(transfer);
+}
+
+UsbAsyncTransport::~UsbAsyncTransport()
+{
+	close();
+}
+
+bool UsbAsyncTransport::open(libusb_context* ctx_, libusb_device_handle* device_, int write_endpoint_, int read_endpoint_)
+{
+	close();
+	ctx = ctx_;
+	device = device_;
+	write_endpoint = write_endpoint_;
+	read_endpoint = read_endpoint_;
+	stopping = false;
+	error = false;
+	received_start = 0;
+	received_count = 0;
+
+	bool allocated = true;
+	for (int i = 0; i < num_in_transfers; i++)
+	{
+		in_transfers[i] = libusb_alloc_transfer(0);
+		allocated = allocated && in_transfers[i];
+	}
+	for (int i = 0; i < num_out_transfers; i++)
+	{
+		out_transfers[i] = libusb_alloc_transfer(0);
+		out_busy[i] = false;
+		allocated = allocated && out_transfers[i];
+	}
+	if (!allocated)
+	{
+		printf("libusb_alloc_transfer failed\n");
+		free_transfers();
+		return false;
+	}
+
+	stop_event_thread = false;
+	event_thread = std::thread(&UsbAsyncTransport::event_thread_main, this);
+
+	// IN transfers don't have a timeout, they are resubmitted as soon as they complete.
+	std::lock_guard<std::mutex> lock(mutex);
+	for (int i = 0; i < num_in_transfers; i++)
+	{
+		libusb_transfer* t = in_transfers[i];
+		libusb_fill_bulk_transfer(t, device, (unsigned char)read_endpoint, in_buffers[i], max_packet_size,
+			&on_in_transfer_done, this, 0);
+		int r = libusb_submit_transfer(t);
+		if (r != 0)
+		{
+			printf("libusb_submit_transfer failed: %d\n", r);
+			error = true;
+			break;
+		}
+		transfers_in_flight++;
+	}
+	return !error;
+}
+
+void UsbAsyncTransport::close()
+{
+	if (!event_thread.joinable())
+		return;
+
+	// Cancel everything that is in flight and wait until the callbacks confirm it.
+	std::unique_lock<std::mutex> lock(mutex);
+	stopping = true;
+	for (int i = 0; i < num_in_transfers; i++)
+		if (in_transfers[i])
+			libusb_cancel_transfer(in_transfers[i]);
+	for (int i = 0; i < num_out_transfers; i++)
+		if (out_busy[i])
+			libusb_cancel_transfer(out_transfers[i]);
+	if (!cv.wait_for(lock, std::chrono::seconds(1), [this]{ return transfers_in_flight == 0; }))
+		printf("usb transfers could not be cancelled\n");
+	lock.unlock();
+
+	stop_event_thread = true;
+	event_thread.join();
+	free_transfers();
+}
+
+void UsbAsyncTransport::free_transfers()
+{
+	// libusb_free_transfer() ignores null.
+	for (int i = 0; i < num_in_transfers; i++)
+	{
+		libusb_free_transfer(in_transfers[i]);
+		in_transfers[i] = nullptr;
+	}
+	for (int i = 0; i < num_out_transfers; i++)
+	{
+		libusb_free_transfer(out_transfers[i]);
+		out_transfers[i] = nullptr;
+	}
+}
+
+bool UsbAsyncTransport::send(const u8* data, int length, u32_micros timeout)
+{
+	assert(length <= max_packet_size);
+	std::unique_lock<std::mutex> lock(mutex);
+	int slot = -1;
+	auto free_slot_available = [&]
+	{
+		if (error || stopping)
+			return true;
+		for (int i = 0; i < num_out_transfers; i++)
+		{
+			if (!out_busy[i])
+			{
+				slot = i;
+				return true;
+			}
+		}
+		return false;
+	};
+	if (!cv.wait_for(lock, std::chrono::microseconds(timeout), free_slot_available))
+	{
+		// ODrive doesn't read anymore. Cancel the packets that are still waiting, so they don't
+		// arrive out of place if it recovers.
+		printf("usb send timeout\n");
+		cancel_send_locked();
+		return false;
+	}
+	if (error || stopping)
+		return false;
+
+	libusb_transfer* t = out_transfers[slot];
+	memcpy(out_buffers[slot], data, length);
+	libusb_fill_bulk_transfer(t, device, (unsigned char)write_endpoint, out_buffers[slot], length,
+		&on_out_transfer_done, this, (timeout+999)/1000);
+	int r = libusb_submit_transfer(t);
+	if (r != 0)
+	{
+		printf("libusb_submit_transfer failed: %d\n", r);
+		error = true;
+		return false;
+	}
+	out_busy[slot] = true;
+	transfers_in_flight++;
+	return true;
+}
+
+int UsbAsyncTransport::receive(u8* data, int max_length, int* received_length, u32_micros timeout)
+{
+	std::unique_lock<std::mutex> lock(mutex);
+	if (!cv.wait_for(lock, std::chrono::microseconds(timeout), [this]{ return received_count > 0 || error; }))
+		return 0;
+	if (received_count == 0)
+		return -1;
+	Packet& p = received[received_start];
+	received_start = (received_start+1) % max_received_packets;
+	received_count--;
+	int length = p.length < max_length ? p.length : max_length;
+	memcpy(data, p.data, length);
+	*received_length = length;
+	return 1;
+}
+
+void UsbAsyncTransport::cancel_send_locked()
+{
+	for (int i = 0; i < num_out_transfers; i++)
+		if (out_busy[i])
+			libusb_cancel_transfer(out_transfers[i]);
+}
+
+void UsbAsyncTransport::in_transfer_done(libusb_transfer* transfer)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	if (transfer->status == LIBUSB_TRANSFER_COMPLETED)
+	{
+		if (received_count < max_received_packets)
+		{
+			Packet& p = received[(received_start+received_count) % max_received_packets];
+			p.length = transfer->actual_length;
+			memcpy(p.data, transfer->buffer, transfer->actual_length);
+			received_count++;
+		}
+		else
+			printf("usb receive queue full, dropping packet\n");
+
+		if (!stopping)
+		{
+			int r = libusb_submit_transfer(transfer);
+			if (r == 0)
+			{
+				cv.notify_all();
+				return;
+			}
+			printf("libusb_submit_transfer failed: %d\n", r);
+			error = true;
+		}
+	}
+	else if (transfer->status != LIBUSB_TRANSFER_CANCELLED)
+	{
+		printf("usb receive transfer failed: %d\n", (int)transfer->status);
+		error = true;
+	}
+	transfers_in_flight--;
+	cv.notify_all();
+}
+
+void UsbAsyncTransport::out_transfer_done(libusb_transfer* transfer)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	for (int i = 0; i < num_out_transfers; i++)
+		if (out_transfers[i] == transfer)
+			out_busy[i] = false;
+	if (transfer->status == LIBUSB_TRANSFER_COMPLETED)
+	{
+		if (transfer->actual_length != transfer->length)
+		{
+			printf("usb send transfer incomplete: %d %d\n", transfer->actual_length, transfer->length);
+			error = true;
+		}
+	}
+	else if (transfer->status != LIBUSB_TRANSFER_CANCELLED)
+	{
+		printf("usb send transfer failed: %d\n", (int)transfer->status);
+		error = true;
+	}
+	transfers_in_flight--;
+	cv.notify_all();
+}
+
+void UsbAsyncTransport::event_thread_main()
+{
+	while (!stop_event_thread)
+	{
+		timeval tv = {0, 100000};
+		libusb_handle_events_timeout_completed(ctx, &tv, nullptr);
+	}
+}
+#endif
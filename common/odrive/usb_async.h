@@ -0,0 +1,77 @@
+// Asynchronous USB transport for the ODrive class, based on the asynchronous API of libusb.
+// All transfers are allocated once when the device is opened. Several IN transfers are always
+// submitted, so libusb picks up responses as soon as they arrive and puts them into a queue.
+// A separate thread handles the libusb events and runs the completion callbacks.
+// Sending doesn't wait until the packet is transferred, so pipelined requests go out
+// back to back. Both sending and receiving have a deadline and close() cancels everything
+// that is still in flight, so a stuck device can't hang the caller.
+#pragma once
+#include "ODrive.h"
+#include "../../common/time_helper.h"
+
+#ifdef ODRIVE_INCLUDE_USB
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+
+struct libusb_transfer;
+
+class UsbAsyncTransport
+{
+public:
+	~UsbAsyncTransport();
+
+	bool open(libusb_context* ctx, libusb_device_handle* device, int write_endpoint, int read_endpoint);
+	void close();
+
+	// Returns false on error or if no transfer became available before the timeout.
+	bool send(const u8* data, int length, u32_micros timeout);
+
+	// Returns 1 if a packet was received, 0 on timeout and -1 on error.
+	int receive(u8* data, int max_length, int* received_length, u32_micros timeout);
+
+	// Called from the libusb callbacks on the event thread.
+	void in_transfer_done(libusb_transfer* transfer);
+	void out_transfer_done(libusb_transfer* transfer);
+
+private:
+	static const int num_in_transfers = 4;
+	static const int num_out_transfers = 16;
+	static const int max_received_packets = 32;
+
+	struct Packet
+	{
+		int length;
+		u8 data[max_packet_size];
+	};
+
+	libusb_context* ctx = nullptr;
+	libusb_device_handle* device = nullptr;
+	int write_endpoint = -1, read_endpoint = -1;
+
+	libusb_transfer* in_transfers[num_in_transfers] = {};
+	libusb_transfer* out_transfers[num_out_transfers] = {};
+	u8 in_buffers[num_in_transfers][max_packet_size];
+	u8 out_buffers[num_out_transfers][max_packet_size];
+	bool out_busy[num_out_transfers] = {};
+
+	// Received packets that haven't been picked up by receive() yet.
+	Packet received[max_received_packets];
+	int received_start = 0, received_count = 0;
+
+	std::mutex mutex;
+	std::condition_variable cv;
+	int transfers_in_flight = 0;
+	bool stopping = false;
+	bool error = false;
+
+	std::thread event_thread;
+	std::atomic<bool> stop_event_thread{false};
+
+	void event_thread_main();
+	void free_transfers();
+	void cancel_send_locked(); // cancels all send transfers that are not done yet
+
+};
+#endif
@@ -735,6 +735,18 @@ void draw_ui_sidebar(float monitor_height, float sidebar_width)
 
 		PLOT_HISTORY("delta_time", md.delta_time * 1000.f);
 		PLOT_HISTORY("delta_time_odrive", md.delta_time_odrive * 0.001f);
+		PLOT_HISTORY("setpoint_skew", md.setpoint_skew * 0.001f);
+		if (ImGui::IsItemHovered()) ImGui::SetTooltip("Time in ms between the setpoints of the first and the last axis arriving at ODrive");
+		PLOT_HISTORY("link_crc_errors", (float)md.link_crc_errors);
+		if (ImGui::IsItemHovered()) ImGui::SetTooltip("UART frames per frame that were corrupted on the way, a sign of a bad cable or baudrate");
+		PLOT_HISTORY("link_resyncs", (float)md.link_resyncs);
+		if (ImGui::IsItemHovered()) ImGui::SetTooltip("How often per frame bytes had to be skipped to find the next UART frame");
+		PLOT_HISTORY("link_unexpected_responses", (float)md.link_unexpected_responses);
+		if (ImGui::IsItemHovered()) ImGui::SetTooltip("Responses per frame that no request was waiting for, usually ones that arrived after the request was sent again");
+		PLOT_HISTORY("link_timeouts", (float)md.link_timeouts);
+		if (ImGui::IsItemHovered()) ImGui::SetTooltip("How often per frame no response arrived in time");
+		PLOT_HISTORY("link_resends", (float)md.link_resends);
+		if (ImGui::IsItemHovered()) ImGui::SetTooltip("Requests per frame that were sent again after a timeout");
 		PLOT_HISTORY("delta_time_sleep", md.delta_time_sleep * 0.001f);
 		PLOT_HISTORY("delta_time_network", md.delta_time_network * 0.001f);
 		PLOT_HISTORY("frame counter", (float)md.counter);
@@ -0,0 +1,84 @@
+// Compares the table driven CRCs of the UART framing (see crc.h) with the bitwise reference:
+// every packet length from 0 to max_packet_size, so also the ones that aren't a multiple of
+// the slices, with random data and random start values, for the crc8 and for the crc16 with 2,
+// 4 and 8 slices. Afterwards the time per packet of each of them is measured for a short
+// request and for a full packet. Returns 1 if a CRC doesn't match the reference.
+#include <stdlib.h>
+#include <stdio.h>
+#include <random>
+#include "../common/odrive/ODrive.h"
+#include "../common/odrive/crc.h"
+#include "../common/time_helper.h"
+
+static const int buffers_per_length = 1000;
+
+static int failures = 0;
+
+static void check(const char* name, size_t length, unsigned crc, unsigned reference)
+{
+	if (crc == reference)
+		return;
+	failures++;
+	if (failures <= 10)
+		printf("%s of %d bytes is 0x%x instead of 0x%x\n", name, (int)length, crc, reference);
+}
+
+// Nanoseconds per call of crc over packets of the given length.
+template<typename Crc>
+static double measure(Crc crc, const u8* data, size_t length)
+{
+	const int iterations = 200000;
+	volatile unsigned sink = 0;
+	u64_micros start = time_micros_64();
+	for (int i = 0; i < iterations; i++)
+		sink = sink + crc(data + (i & 7), length);
+	return (double)(time_micros_64() - start) * 1000.0 / iterations;
+}
+
+static void benchmark(const u8* data, size_t length)
+{
+	const uint8_t crc8_init = CANONICAL_CRC8_INIT;
+	const uint16_t crc16_init = CANONICAL_CRC16_INIT;
+	const unsigned crc8_polynomial = CANONICAL_CRC8_POLYNOMIAL, crc16_polynomial = CANONICAL_CRC16_POLYNOMIAL;
+	printf("%3d bytes: crc8 bitwise %6.1f ns, table %6.1f ns | crc16 bitwise %6.1f ns, 2 slices %6.1f ns, 4 slices %6.1f ns, 8 slices %6.1f ns\n",
+		(int)length,
+		measure([](const u8* d, size_t l) { return (unsigned)calc_crc_bitwise<uint8_t, crc8_polynomial>(crc8_init, d, l); }, data, length),
+		measure([](const u8* d, size_t l) { return (unsigned)calc_crc<uint8_t, crc8_polynomial, 1>(crc8_init, d, l); }, data, length),
+		measure([](const u8* d, size_t l) { return (unsigned)calc_crc_bitwise<uint16_t, crc16_polynomial>(crc16_init, d, l); }, data, length),
+		measure([](const u8* d, size_t l) { return (unsigned)calc_crc<uint16_t, crc16_polynomial, 2>(crc16_init, d, l); }, data, length),
+		measure([](const u8* d, size_t l) { return (unsigned)calc_crc<uint16_t, crc16_polynomial, 4>(crc16_init, d, l); }, data, length),
+		measure([](const u8* d, size_t l) { return (unsigned)calc_crc<uint16_t, crc16_polynomial, 8>(crc16_init, d, l); }, data, length));
+}
+
+int main()
+{
+	time_init();
+	std::mt19937 rng(1);
+	const unsigned crc8_polynomial = CANONICAL_CRC8_POLYNOMIAL, crc16_polynomial = CANONICAL_CRC16_POLYNOMIAL;
+
+	// The data starts at a random offset, so the slices don't always start aligned.
+	u8 buffer[max_packet_size+8];
+	for (size_t length = 0; length <= (size_t)max_packet_size; length++)
+	{
+		for (int n = 0; n < buffers_per_length; n++)
+		{
+			const u8* data = buffer + rng() % 8;
+			for (u8& b : buffer)
+				b = (u8)rng();
+			uint8_t init8 = (uint8_t)rng();
+			uint16_t init16 = (uint16_t)rng();
+			uint8_t reference8 = calc_crc_bitwise<uint8_t, crc8_polynomial>(init8, data, length);
+			uint16_t reference16 = calc_crc_bitwise<uint16_t, crc16_polynomial>(init16, data, length);
+			check("crc8", length, calc_crc<uint8_t, crc8_polynomial, 1>(init8, data, length), reference8);
+			check("crc16 with 2 slices", length, calc_crc<uint16_t, crc16_polynomial, 2>(init16, data, length), reference16);
+			check("crc16 with 4 slices", length, calc_crc<uint16_t, crc16_polynomial, 4>(init16, data, length), reference16);
+			check("crc16 with 8 slices", length, calc_crc<uint16_t, crc16_polynomial, 8>(init16, data, length), reference16);
+			check("calc_crc16", length, calc_crc16<crc16_polynomial>(init16, data, length), reference16);
+		}
+	}
+	printf("%d CRCs of %d lengths checked, %d wrong\n", 5*buffers_per_length*(max_packet_size+1), max_packet_size+1, failures);
+
+	benchmark(buffer, 8);
+	benchmark(buffer, max_packet_size);
+	return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,304 @@
+// Generates a C++ header from a json interface of ODrive. Every endpoint becomes a
+// TypedEndpoint (see typed_endpoint.h) with its id and type, in nested namespaces that follow
+// the path, so ".axis0.encoder.pos_estimate" becomes ep::axis0::encoder::pos_estimate.
+// The json is the file that ODrive saves in ODrive::json_cache_folder (the proxy does that
+// with --json-cache), its name contains the json crc the generated ids are valid for.
+// With --sim the json interface of the simulated ODrive (see odrive_sim.h) is used instead.
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <stdexcept>
+#include "../common/odrive/endpoint.h"
+#include "../common/odrive/ODrive.h"
+#include "../common/odrive/odrive_sim.h"
+
+struct Params
+{
+	std::string json_filename;
+	std::string header_filename;
+	std::string namespace_name = "ep";
+	std::string include = "typed_endpoint.h";
+	bool has_crc = false;
+	u32 crc = 0;
+	bool sim = false;
+};
+
+static void print_usage(char** argv, const Params& params)
+{
+	printf("Generates a header with the endpoint ids and types of an ODrive json interface.\n");
+	printf("\n");
+	printf("usage: %s [options] <odrive_interface_XXXXXXXX.json> <output.h>\n", argv[0]);
+	printf("       %s [options] --sim <output.h>\n", argv[0]);
+	printf("\n");
+	printf("options:\n");
+	printf("  -h, --help            show this help message and exit\n");
+	printf("  --crc N               json crc the ids are valid for (default: taken from the file name)\n");
+	printf("  --namespace NAME      namespace of the generated endpoints (default: %s)\n", params.namespace_name.c_str());
+	printf("  --include PATH        how the header includes typed_endpoint.h (default: %s)\n", params.include.c_str());
+	printf("  --sim                 use the json interface of the simulated ODrive\n");
+	printf("\n");
+}
+
+static bool params_parse_ex(int argc, char** argv, Params& params)
+{
+	bool invalid_param = false;
+	std::string arg;
+	std::vector<std::string> filenames;
+	for (int i = 1; i < argc; i++)
+	{
+		arg = argv[i];
+		if (arg == "-h" || arg == "--help")
+		{
+			return false;
+		}
+		else if (arg == "--crc")
+		{
+			if (++i >= argc)
+			{
+				invalid_param = true;
+				break;
+			}
+			params.crc = (u32)std::stoul(argv[i], nullptr, 0);
+			params.has_crc = true;
+		}
+		else if (arg == "--namespace")
+		{
+			if (++i >= argc)
+			{
+				invalid_param = true;
+				break;
+			}
+			params.namespace_name = argv[i];
+		}
+		else if (arg == "--include")
+		{
+			if (++i >= argc)
+			{
+				invalid_param = true;
+				break;
+			}
+			params.include = argv[i];
+		}
+		else if (arg == "--sim")
+		{
+			params.sim = true;
+		}
+		else if (arg.size() && arg[0] == '-')
+		{
+			throw std::invalid_argument("error: unknown argument: " + arg);
+		}
+		else
+		{
+			filenames.push_back(arg);
+		}
+	}
+	if (invalid_param)
+	{
+		throw std::invalid_argument("error: invalid parameter for argument: " + arg);
+	}
+	if (params.sim)
+	{
+		if (filenames.size() != 1)
+		{
+			throw std::invalid_argument("error: expected an output file");
+		}
+		params.header_filename = filenames[0];
+		return true;
+	}
+	if (filenames.size() != 2)
+	{
+		throw std::invalid_argument("error: expected a json file and an output file");
+	}
+	params.json_filename = filenames[0];
+	params.header_filename = filenames[1];
+	return true;
+}
+
+static void params_parse(int argc, char** argv, Params& params)
+{
+	try
+	{
+		if (!params_parse_ex(argc, argv, params))
+		{
+			print_usage(argv, Params());
+			exit(0);
+		}
+	}
+	catch (const std::exception& ex)
+	{
+		fprintf(stderr, "%s\n", ex.what());
+		print_usage(argv, Params());
+		exit(1);
+	}
+}
+
+// The cache files are called odrive_interface_%08x.json, see json_cache_filename() in ODrive.cpp.
+static bool crc_from_filename(const std::string& filename, u32* crc)
+{
+	size_t pos = filename.rfind("odrive_interface_");
+	if (pos == std::string::npos)
+		return false;
+	return sscanf(filename.c_str() + pos, "odrive_interface_%8x.json", crc) == 1;
+}
+
+static const char* cpp_type(EndpointType type)
+{
+	switch (type)
+	{
+	case EndpointType::boolean: return "bool";
+	case EndpointType::uint8:   return "u8";
+	case EndpointType::int8:    return "s8";
+	case EndpointType::uint16:  return "u16";
+	case EndpointType::int16:   return "s16";
+	case EndpointType::uint32:  return "u32";
+	case EndpointType::int32:   return "s32";
+	case EndpointType::uint64:  return "u64";
+	case EndpointType::int64:   return "s64";
+	case EndpointType::float32: return "float";
+	default: return nullptr;
+	}
+}
+
+// ODrive names are valid identifiers already, except if they happen to be a keyword.
+static std::string identifier(const char* name)
+{
+	static const char* keywords[] = {"and", "auto", "bool", "break", "case", "char", "class", "const",
+		"default", "delete", "do", "double", "else", "enum", "explicit", "float", "for", "goto", "if",
+		"int", "long", "new", "not", "operator", "or", "private", "public", "register", "return",
+		"short", "signed", "sizeof", "static", "struct", "switch", "template", "this", "union",
+		"unsigned", "using", "virtual", "void", "volatile", "while"};
+	std::string result;
+	if (*name >= '0' && *name <= '9')
+		result += '_';
+	for (const char* c = name; *c; c++)
+	{
+		bool valid = (*c >= 'a' && *c <= 'z') || (*c >= 'A' && *c <= 'Z') || (*c >= '0' && *c <= '9') || *c == '_';
+		result += valid ? *c : '_';
+	}
+	for (const char* keyword : keywords)
+	{
+		if (result == keyword)
+			return result + '_';
+	}
+	return result;
+}
+
+static void generate(const Endpoint& endpoint, int depth, std::string& out, int* count)
+{
+	std::string indent(depth, '\t');
+	char line[512];
+	for (int i = 0; i < endpoint.num_children; i++)
+	{
+		const Endpoint& child = endpoint.children[i];
+		std::string name = identifier(child.short_name);
+		if (child.num_children)
+		{
+			out += indent + "namespace " + name + " {\n";
+			generate(child, depth+1, out, count);
+			out += indent + "}\n";
+		}
+		else if (child.type_enum == EndpointType::function)
+		{
+			if (child.num_inputs || child.num_outputs)
+			{
+				out += indent + "// " + name + "() has parameters or return values, use Endpoint::call()\n";
+				continue;
+			}
+			snprintf(line, sizeof(line), "constexpr TypedFunction<%d, json_crc> %s = {\"%s\"};\n",
+				child.id, name.c_str(), child.name);
+			out += indent + line;
+			(*count)++;
+		}
+		else if (cpp_type(child.type_enum) && child.id >= 0)
+		{
+			snprintf(line, sizeof(line), "constexpr TypedEndpoint<%s, %d, json_crc> %s = {\"%s\"};\n",
+				cpp_type(child.type_enum), child.id, name.c_str(), child.name);
+			out += indent + line;
+			(*count)++;
+		}
+		else
+		{
+			out += indent + "// " + name + " has an unknown type: " + child.type + "\n";
+		}
+	}
+}
+
+int main(int argc, char** argv)
+{
+	Params params;
+	params_parse(argc, argv, params);
+
+	std::vector<char> json;
+	FILE* file;
+	if (params.sim)
+	{
+		// The crc is the one ODrive gets when it connects to the simulator.
+		time_init();
+		ODriveSim sim;
+		ODrive odrive;
+		if (!odrive.connect_sim(&sim))
+			return EXIT_FAILURE;
+		if (!params.has_crc)
+			params.crc = odrive.get_json_crc();
+		odrive.close();
+		json.assign(sim.get_json().begin(), sim.get_json().end());
+		params.json_filename = "the simulated ODrive";
+	}
+	else
+	{
+		if (!params.has_crc && !crc_from_filename(params.json_filename, &params.crc))
+		{
+			printf("Cannot get the json crc from the file name %s, pass it with --crc\n", params.json_filename.c_str());
+			return EXIT_FAILURE;
+		}
+
+		file = fopen(params.json_filename.c_str(), "rb");
+		if (!file)
+		{
+			printf("Cannot open %s\n", params.json_filename.c_str());
+			return EXIT_FAILURE;
+		}
+		char buffer[4096];
+		size_t n;
+		while ((n = fread(buffer, 1, sizeof(buffer), file)) > 0)
+			json.insert(json.end(), buffer, buffer+n);
+		fclose(file);
+	}
+
+	EndpointTable table;
+	if (!table.parse(json.data(), json.size(), nullptr))
+	{
+		printf("%s is not a valid json interface\n", params.json_filename.c_str());
+		return EXIT_FAILURE;
+	}
+
+	std::string out;
+	char line[512];
+	snprintf(line, sizeof(line), "// Generated by endpoint_codegen from %s, do not edit.\n", params.json_filename.c_str());
+	out += line;
+	out += "// The ids are only valid for firmware with this json crc, otherwise the endpoints are looked\n";
+	out += "// up by path (see typed_endpoint.h).\n";
+	out += "#pragma once\n";
+	out += "#include \"" + params.include + "\"\n";
+	out += "\n";
+	out += "namespace " + params.namespace_name + " {\n";
+	snprintf(line, sizeof(line), "constexpr u32 json_crc = 0x%08x;\n", params.crc);
+	out += line;
+	int count = 0;
+	generate(table.root, 0, out, &count);
+	out += "}\n";
+
+	file = fopen(params.header_filename.c_str(), "wb");
+	if (!file || fwrite(out.data(), out.size(), 1, file) != 1)
+	{
+		printf("Cannot write %s\n", params.header_filename.c_str());
+		if (file)
+			fclose(file);
+		return EXIT_FAILURE;
+	}
+	fclose(file);
+	printf("Wrote %d endpoints to %s\n", count, params.header_filename.c_str());
+	return EXIT_SUCCESS;
+}
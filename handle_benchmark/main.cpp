@@ -0,0 +1,184 @@
+// Measures what EndpointHandle saves compared to looking up the endpoints by name every frame.
+// A frame like the one of the proxy (a setpoint and the feedback of both axes) is queued in a
+// pipeline and sent to a simulated ODrive (see odrive_sim.h) without latency. It is done once
+// with chained operator() lookups, like odrive.root("axis0")("encoder")("pos_estimate"), and
+// once with handles that were resolved before. For both, the time to queue the requests and
+// the time of the whole frame are printed.
+#include <stdlib.h>
+#include <stdio.h>
+#include <string>
+#include <stdexcept>
+#include "../common/odrive/ODrive.h"
+#include "../common/odrive/odrive_sim.h"
+#include "../common/time_helper.h"
+
+struct Params
+{
+	int frames = 20000;
+};
+
+static void print_usage(char** argv, const Params& params)
+{
+	printf("Compares the time of a frame with endpoint lookups by name and with EndpointHandles.\n");
+	printf("\n");
+	printf("usage: %s [options]\n", argv[0]);
+	printf("\n");
+	printf("options:\n");
+	printf("  -h, --help            show this help message and exit\n");
+	printf("  -n N, --frames N      frames of each variant (default: %d)\n", params.frames);
+	printf("\n");
+}
+
+static bool params_parse_ex(int argc, char** argv, Params& params)
+{
+	bool invalid_param = false;
+	std::string arg;
+	for (int i = 1; i < argc; i++)
+	{
+		arg = argv[i];
+		if (arg == "-h" || arg == "--help")
+		{
+			return false;
+		}
+		else if (arg == "-n" || arg == "--frames")
+		{
+			if (++i >= argc)
+			{
+				invalid_param = true;
+				break;
+			}
+			params.frames = std::stoi(argv[i]);
+			if (params.frames <= 0)
+			{
+				invalid_param = true;
+				break;
+			}
+		}
+		else
+		{
+			invalid_param = true;
+			break;
+		}
+	}
+	if (invalid_param)
+		throw std::invalid_argument("error: invalid parameter \"" + arg + "\"");
+	return true;
+}
+
+static void params_parse(int argc, char** argv, Params& params)
+{
+	try
+	{
+		if (!params_parse_ex(argc, argv, params))
+		{
+			print_usage(argv, Params());
+			exit(0);
+		}
+	}
+	catch (const std::exception& ex)
+	{
+		fprintf(stderr, "%s\n", ex.what());
+		print_usage(argv, Params());
+		exit(1);
+	}
+}
+
+static const int num_axes = 2;
+static const char* axis_names[num_axes] = {"axis0", "axis1"};
+
+struct Feedback
+{
+	float pos, vel, current;
+	s32 shadow_count;
+	u64 error;
+};
+static Feedback feedback[num_axes];
+
+struct AxisHandles
+{
+	EndpointHandle input_pos, pos_estimate, vel_estimate, Iq_setpoint, shadow_count, error;
+};
+static AxisHandles handles[num_axes];
+
+static void queue_with_lookups(ODrive& odrive, int frame)
+{
+	for (int a = 0; a < num_axes; a++)
+	{
+		Endpoint& axis = odrive.root(axis_names[a]);
+		axis("controller")("input_pos").set(.001f*frame);
+		axis("encoder")("pos_estimate").get(feedback[a].pos);
+		axis("encoder")("vel_estimate").get(feedback[a].vel);
+		axis("motor")("current_control")("Iq_setpoint").get(feedback[a].current);
+		axis("encoder")("shadow_count").get(feedback[a].shadow_count);
+		axis("motor")("error").get(feedback[a].error);
+	}
+}
+
+static void queue_with_handles(ODrive& odrive, int frame)
+{
+	for (int a = 0; a < num_axes; a++)
+	{
+		const AxisHandles& h = handles[a];
+		h.input_pos.set(.001f*frame);
+		h.pos_estimate.get(feedback[a].pos);
+		h.vel_estimate.get(feedback[a].vel);
+		h.Iq_setpoint.get(feedback[a].current);
+		h.shadow_count.get(feedback[a].shadow_count);
+		h.error.get(feedback[a].error);
+	}
+}
+
+static bool run(const char* name, ODrive& odrive, int frames, void (*queue)(ODrive&, int))
+{
+	u64_micros queue_time = 0, frame_time = 0;
+	for (int frame = 0; frame < frames && !odrive.communication_error; frame++)
+	{
+		u64_micros start = time_micros_64();
+		odrive.pipeline_begin();
+		queue(odrive, frame);
+		u64_micros queued = time_micros_64();
+		odrive.pipeline_end();
+		queue_time += queued - start;
+		frame_time += time_micros_64() - start;
+	}
+	if (odrive.communication_error)
+	{
+		printf("%s: communication error\n", name);
+		return false;
+	}
+	printf("%-8s queue %6.3f us, frame %6.3f us\n", name, (double)queue_time / frames, (double)frame_time / frames);
+	return true;
+}
+
+int main(int argc, char** argv)
+{
+	Params params;
+	params_parse(argc, argv, params);
+	time_init();
+
+	ODriveSim sim;
+	sim.latency = 0;
+	ODrive odrive;
+	if (!odrive.connect_sim(&sim))
+		return EXIT_FAILURE;
+
+	for (int a = 0; a < num_axes; a++)
+	{
+		Endpoint& axis = odrive.root(axis_names[a]);
+		AxisHandles& h = handles[a];
+		h.input_pos    = axis("controller")("input_pos").handle();
+		h.pos_estimate = axis("encoder")("pos_estimate").handle();
+		h.vel_estimate = axis("encoder")("vel_estimate").handle();
+		h.Iq_setpoint  = axis("motor")("current_control")("Iq_setpoint").handle();
+		h.shadow_count = axis("encoder")("shadow_count").handle();
+		h.error        = axis("motor")("error").handle();
+	}
+
+	printf("%d frames of %d requests each\n", params.frames, 6*num_axes);
+	// The first run warms up the caches, so both are run twice.
+	bool ok = run("lookups", odrive, params.frames, queue_with_lookups) &&
+		run("handles", odrive, params.frames, queue_with_handles) &&
+		run("lookups", odrive, params.frames, queue_with_lookups) &&
+		run("handles", odrive, params.frames, queue_with_handles);
+	return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
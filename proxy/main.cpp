@@ -67,12 +67,28 @@ void print_usage(int /*argc*/, char** argv, const Params& params)
     printf("options:\n");
     printf("  -h, --help            show this help message and exit\n");
     printf("  --usb                 connect with ODrive via USB\n");
+    printf("  --usb-serial SERIAL   connect with the ODrive with this serial number via USB\n");
+    printf("  --list-usb            list all ODrives connected via USB and exit\n");
+    printf("  --usb-async           use asynchronous libusb transfers with a separate event thread\n");
     printf("  --uart ADDRESS        connect with ODrive via UART\n");
+    printf("  --uart-ascii FILE     use the ASCII protocol on the UART, the json interface is loaded from FILE (as cached with --json-cache)\n");
+    printf("  --sim                 connect with a simulated ODrive in this process\n");
+    printf("  --sim-latency US      response latency of the simulated ODrive in microseconds (default: %u)\n", params.sim_latency);
+    printf("  --sim-loss P          probability that the simulated ODrive loses a packet (default: %g)\n", params.sim_loss);
     printf("  -b N, --baudrate N    specify uart baudrate (default: %d)\n", params.uart_baud_rate);
     printf("  -s N, --stop-bits N   specify number of uart stop bits (1 or 2) (default: %d)\n", params.uart_stop_bits);
+    printf("  --stats N             collect statistics per endpoint and print the N slowest ones every 10s and after slow frames\n");
+    printf("  --max-timeout-ms N    upper bound of the adaptive timeout after which requests are sent again (default: %u)\n", params.max_retransmit_timeout_ms);
+    printf("  --request-timeout-ms N time after which a request fails with a communication error (default: %u)\n", params.request_timeout_ms);
+    printf("  --error-sweep-interval N with stock firmware, check all sub errors of ODrive or one axis every N frames, 0 for every frame (default: %d)\n", params.error_sweep_interval);
+    printf("  --backup-config FILE  save all config values of ODrive to FILE and exit\n");
+    printf("  --restore-config FILE write the config values in FILE that differ from the ones on ODrive and exit\n");
     printf("  -p N, --port N        port to listen to for control_ui connections (default: %d)\n", params.port);
     printf("  -w, --wait-input      wait for input after exit\n");
     printf("  -nc, --no-clear       do not clear ODrive errors on startup\n");
+    printf("  --json-cache DIR      folder where the ODrive json interface is cached (default: %s)\n", params.json_cache_folder.c_str());
+    printf("  --no-json-cache       always download the json interface and don't cache it\n");
+    printf("  --refresh-json        download the json interface again, even if it is cached\n");
     printf("\n");
 }
 
@@ -109,6 +125,121 @@ bool params_parse_ex(int argc, char** argv, Params& params)
                 break;
             }
         }
+        else if (arg == "--uart-ascii")
+        {
+            if (++i >= argc)
+            {
+                invalid_param = true;
+                break;
+            }
+            params.uart_ascii_json = argv[i];
+            if (params.uart_ascii_json.size() == 0)
+            {
+                invalid_param = true;
+                break;
+            }
+        }
+        else if (arg == "--sim")
+        {
+            params.connect_sim = true;
+        }
+        else if (arg == "--sim-latency")
+        {
+            if (++i >= argc)
+            {
+                invalid_param = true;
+                break;
+            }
+            params.sim_latency = (u32)std::stoul(argv[i]);
+        }
+        else if (arg == "--sim-loss")
+        {
+            if (++i >= argc)
+            {
+                invalid_param = true;
+                break;
+            }
+            params.sim_loss = std::stof(argv[i]);
+            if (params.sim_loss < 0 || params.sim_loss >= 1)
+            {
+                invalid_param = true;
+                break;
+            }
+        }
+        else if (arg == "--max-timeout-ms")
+        {
+            if (++i >= argc)
+            {
+                invalid_param = true;
+                break;
+            }
+            params.max_retransmit_timeout_ms = (u32)std::stoul(argv[i]);
+            if (params.max_retransmit_timeout_ms == 0)
+            {
+                invalid_param = true;
+                break;
+            }
+        }
+        else if (arg == "--error-sweep-interval")
+        {
+            if (++i >= argc)
+            {
+                invalid_param = true;
+                break;
+            }
+            params.error_sweep_interval = std::stoi(argv[i]);
+            if (params.error_sweep_interval < 0)
+            {
+                invalid_param = true;
+                break;
+            }
+        }
+        else if (arg == "--backup-config")
+        {
+            if (++i >= argc)
+            {
+                invalid_param = true;
+                break;
+            }
+            params.config_backup_file = argv[i];
+        }
+        else if (arg == "--restore-config")
+        {
+            if (++i >= argc)
+            {
+                invalid_param = true;
+                break;
+            }
+            params.config_restore_file = argv[i];
+        }
+        else if (arg == "--request-timeout-ms")
+        {
+            if (++i >= argc)
+            {
+                invalid_param = true;
+                break;
+            }
+            params.request_timeout_ms = (u32)std::stoul(argv[i]);
+            if (params.request_timeout_ms == 0)
+            {
+                invalid_param = true;
+                break;
+            }
+        }
+        else if (arg == "--stats")
+        {
+            if (++i >= argc)
+            {
+                invalid_param = true;
+                break;
+            }
+            params.stats_top = std::stoi(argv[i]);
+            if (params.stats_top <= 0)
+            {
+                invalid_param = true;
+                break;
+            }
+        }
         else if (arg == "-b" || arg == "--baudrate")
         {
             if (++i >= argc)
@@ -136,6 +267,24 @@ bool params_parse_ex(int argc, char** argv, Params& params)
         {
             params.connect_usb = true;
         }
+        else if (arg == "--usb-serial")
+        {
+            params.connect_usb = true;
+            if (++i >= argc)
+            {
+                invalid_param = true;
+                break;
+            }
+            params.usb_serial = argv[i];
+        }
+        else if (arg == "--list-usb")
+        {
+            params.list_usb = true;
+        }
+        else if (arg == "--usb-async")
+        {
+            params.usb_async = true;
+        }
         else if (arg == "-p" || arg == "--port")
         {
             if (++i >= argc)
@@ -153,6 +302,28 @@ bool params_parse_ex(int argc, char** argv, Params& params)
         {
             params.clear_errors_on_startup = false;
         }
+        else if (arg == "--json-cache")
+        {
+            if (++i >= argc)
+            {
+                invalid_param = true;
+                break;
+            }
+            params.json_cache_folder = argv[i];
+            if (params.json_cache_folder.size() == 0)
+            {
+                invalid_param = true;
+                break;
+            }
+        }
+        else if (arg == "--no-json-cache")
+        {
+            params.json_cache_folder.clear();
+        }
+        else if (arg == "--refresh-json")
+        {
+            params.json_cache_refresh = true;
+        }
         else
             throw std::invalid_argument("error: unknown argument: " + arg);
     }
@@ -160,14 +331,23 @@ bool params_parse_ex(int argc, char** argv, Params& params)
     {
         throw std::invalid_argument("error: invalid parameter for argument: " + arg);
     }
-    if (!params.connect_usb && !params.connect_uart)
+    if (params.list_usb)
+    {
+        return true;
+    }
+    int num_connections = (int)params.connect_usb + (int)params.connect_uart + (int)params.connect_sim;
+    if (num_connections == 0)
     {
         return false;
     }
-    if (params.connect_usb && params.connect_uart)
+    if (num_connections > 1)
     {
         throw std::invalid_argument("error: invalid arguments\n");
     }
+    if (params.uart_ascii_json.size() && !params.connect_uart)
+    {
+        throw std::invalid_argument("error: --uart-ascii needs --uart\n");
+    }
 
     return true;
 }
@@ -200,7 +380,19 @@ int main(int argc, char *argv[])
     Params params;
     params_parse(argc, argv, params);
 
+	if (params.list_usb)
+	{
+		odrive_control_list_usb();
+		return EXIT_SUCCESS;
+	}
+
 	time_init();
+
+	if (params.config_backup_file.size() || params.config_restore_file.size())
+	{
+		return odrive_control_config_backup(params) ? EXIT_SUCCESS : EXIT_FAILURE;
+	}
+
 	net_startup();
 
 	if (!odrive_control_init(params)) goto fail;
@@ -5,13 +5,28 @@
 struct Params
 {
     bool connect_usb = false;
+    bool usb_async = false;
+    std::string usb_serial;
+    bool list_usb = false;
     bool connect_uart = false;
+    bool connect_sim = false;
+    u32 sim_latency = 200; // microseconds
+    float sim_loss = 0;
     std::string uart_address;
+    std::string uart_ascii_json; // use the ASCII protocol with this json interface
     int uart_baud_rate = 115200;
     int uart_stop_bits = 2;
     u16 port = ::port;
     bool wait_for_input_after_exit = false;
     bool clear_errors_on_startup = true;
+    std::string json_cache_folder = "odrive_json_cache";
+    bool json_cache_refresh = false;
+    int stats_top = 0; // print the slowest endpoints if > 0
+    u32 max_retransmit_timeout_ms = 100;
+    u32 request_timeout_ms = 1000;
+    int error_sweep_interval = 50; // frames, see check_errors_and_watchdog_feed()
+    std::string config_backup_file;
+    std::string config_restore_file;
 };
 
 extern bool running;
@@ -5,6 +5,10 @@
 #include "odrive_control.h"
 #include "../common/odrive/ODrive.h"
 #include "../common/odrive/odrive_helper.h"
+#include "../common/odrive/odrive_sim.h"
+#include "../common/odrive/config_backup.h"
+#include "../common/odrive/snapshot.h"
+#include "../common/odrive/odrive_poller.h"
 #include "main.h"
 
 #include <string>
@@ -13,11 +17,43 @@
 void odrive_control_get_control_data();
 void odrive_control_set_control_data();
 void odrive_control_axis_get_control_data(int a);
-void odrive_control_update_axis(int a);
+void odrive_control_update_axes(const bool* axes);
 
 ODrive odrive;
+static int stats_top;
+static int error_sweep_interval;
 static int cd_counter;
 static int cd_counter_axis[monitor_axes];
+static LinkStats last_link_stats;
+
+// Endpoints that are used every frame. These are resolved once after connecting.
+struct AxisEndpoints
+{
+	EndpointHandle watchdog_feed;
+	EndpointHandle error;
+	EndpointHandle requested_state;
+	EndpointHandle input_pos, input_vel, input_torque;
+	// pos_estimate, vel_estimate, Iq_setpoint
+	Snapshot<float, float, float> feedback;
+};
+static AxisEndpoints axis_endpoints[monitor_axes];
+static EndpointHandle odrive_error;
+
+// Values we want for debugging purposes, but that aren't worth the time to read them in every
+// frame. The poller reads them in the background at these rates (per second).
+static ODrivePoller poller;
+const float poller_frame_rate = 50;
+struct PolledValues
+{
+	int vbus_voltage = -1, ibus = -1;
+	struct Axis
+	{
+		int index_check_cumulative_error = -1, index_check_index_count = -1;
+		int shadow_count = -1;
+		int anticogging_valid = -1;
+	} axes[monitor_axes];
+};
+static PolledValues polled;
 
 Endpoint& get_axis(int axis)
 {
@@ -52,6 +88,63 @@ float half_to_float(u16 x)
     return as_float((x&0x8000)<<16 | (e!=0)*((e+112)<<23|m) | ((e==0)&(m!=0))*((v-37)<<23|((m<<(150-v))&0x007FE000))); // sign : normalized : denormalized
 }
 
+static void resolve_endpoints()
+{
+	if (!odrive.root.odrive_fw_is_milana())
+		odrive_error = odrive.root("error").handle();
+	for (int a = 0; a < monitor_axes; a++)
+	{
+		Endpoint& axis = get_axis(a);
+		AxisEndpoints& e = axis_endpoints[a];
+		e.watchdog_feed   = axis("watchdog_feed").handle();
+		e.error           = axis("error").handle();
+		e.requested_state = axis("requested_state").handle();
+		e.input_pos       = axis("controller")("input_pos").handle();
+		e.input_vel       = axis("controller")("input_vel").handle();
+		e.input_torque    = axis("controller")("input_torque").handle();
+		// pos_estimate and vel_estimate are one "f" command with the ASCII protocol, so keep them together.
+		e.feedback.resolve(axis, {"encoder.pos_estimate", "encoder.vel_estimate", "motor.current_control.Iq_setpoint"});
+	}
+}
+
+static void add_polled_values()
+{
+	polled.vbus_voltage = poller.add(odrive.root("vbus_voltage").handle(), 10);
+	polled.ibus         = poller.add(odrive.root("ibus").handle(), 10);
+	for (int a = 0; a < monitor_axes; a++)
+	{
+		Endpoint& encoder = get_axis(a)("encoder");
+		PolledValues::Axis& p = polled.axes[a];
+		if (odrive.root.odrive_fw_is_milana())
+		{
+			p.index_check_cumulative_error = poller.add(encoder("index_check_cumulative_error").handle(), 5);
+			p.index_check_index_count      = poller.add(encoder("index_check_index_count").handle(), 5);
+		}
+		p.shadow_count      = poller.add(encoder("shadow_count").handle(), 10);
+		p.anticogging_valid = poller.add(get_axis(a)("controller")("anticogging_valid").handle(), 2);
+	}
+}
+
+// The control data is written completely whenever control_ui changes any of it, and the
+// setpoints every frame. With shadow values only the ones that changed are actually sent.
+static void enable_shadow_values()
+{
+	odrive.enable_shadow(odrive.root("config"));
+	odrive.enable_shadow(odrive.root("ibus_report_filter_k"));
+	if (odrive.root.odrive_fw_is_milana())
+		odrive.enable_shadow(odrive.root("generate_error_on_filtered_ibus"));
+	for (int a = 0; a < monitor_axes; a++)
+	{
+		Endpoint& axis = get_axis(a);
+		odrive.enable_shadow(axis("motor")("config"));
+		odrive.enable_shadow(axis("controller")("config"));
+		odrive.enable_shadow(axis("encoder")("config"));
+		odrive.enable_shadow(axis("controller")("input_pos"));
+		odrive.enable_shadow(axis("controller")("input_vel"));
+		odrive.enable_shadow(axis("controller")("input_torque"));
+	}
+}
+
 static bool check_errors_and_watchdog_feed()
 {
 	if (odrive.communication_error)
@@ -65,10 +158,49 @@ static bool check_errors_and_watchdog_feed()
 		// This is a function that combines these calls to make things a bit faster
 		odrive.root("any_errors_and_watchdog_feed").get(any_errors);
 	}
+	else if (error_sweep_interval)
+	{
+		// Stock firmware has no such function. The errors of motor, encoder and controller set a
+		// flag in the axis error, so only the top level errors are read along with the watchdog
+		// feeds and the sub errors are only checked when one of them is set.
+		s64 error = 0;
+		s64 axis_error[monitor_axes] = {};
+		odrive.pipeline_begin();
+		odrive_error.get(error);
+		for (int a = 0; a < monitor_axes; a++)
+		{
+			axis_endpoints[a].watchdog_feed.call();
+			axis_endpoints[a].error.get(axis_error[a]);
+		}
+		odrive.pipeline_end();
+		any_errors = error != 0;
+		for (int a = 0; a < monitor_axes; a++)
+			any_errors = any_errors || axis_error[a] != 0;
+
+		// Some errors don't show up there, like the can error. Those are found by checking
+		// ODrive or one of the axes completely every error_sweep_interval frames, in turn.
+		static int frames_since_sweep = 0;
+		static int sweep_target = 0;
+		if (!any_errors && ++frames_since_sweep >= error_sweep_interval)
+		{
+			frames_since_sweep = 0;
+			sweep_target = (sweep_target+1) % (monitor_axes+1);
+			int num_errors = 0;
+			if (sweep_target == monitor_axes)
+				check_odrive_errors(&odrive.root, num_errors);
+			else
+				check_axis_errors(&get_axis(sweep_target), axis_names[sweep_target], num_errors);
+			if (num_errors)
+				odrive.invalidate_shadow();
+			return num_errors == 0;
+		}
+	}
 	else
 	{
+		odrive.pipeline_begin();
 		for (int a = 0; a < monitor_axes; a++)
-			get_axis(a)("watchdog_feed").call();
+			axis_endpoints[a].watchdog_feed.call();
+		odrive.pipeline_end();
 		//odrive.root("any_error").call(&any_errors);
 	}
 	if (!any_errors)
@@ -80,22 +212,57 @@ static bool check_errors_and_watchdog_feed()
 	check_odrive_errors(&odrive.root, num_errors);
 	for (int a = 0; a < monitor_axes; a++)
 		check_axis_errors(&get_axis(a), axis_names[a], num_errors);
+	// ODrive may have changed values itself while handling the error.
+	if (num_errors)
+		odrive.invalidate_shadow();
 		
 	return num_errors == 0;
 }
 
-bool odrive_control_init(const Params& params)
+static bool odrive_control_connect(const Params& params)
 {
+	odrive.json_cache_folder = params.json_cache_folder;
+	odrive.json_cache_refresh = params.json_cache_refresh;
+	odrive.usb_async = params.usb_async;
+	odrive.max_retransmit_timeout = params.max_retransmit_timeout_ms*1000;
+	odrive.request_timeout = params.request_timeout_ms*1000;
 	if (params.connect_uart)
 	{
-		if (!odrive.connect_uart(params.uart_address.c_str(), params.uart_baud_rate, params.uart_stop_bits == 2)) return false;
+		if (params.uart_ascii_json.size())
+		{
+			if (!odrive.connect_uart_ascii(params.uart_address.c_str(), params.uart_baud_rate, params.uart_stop_bits == 2,
+				params.uart_ascii_json.c_str())) return false;
+		}
+		else if (!odrive.connect_uart(params.uart_address.c_str(), params.uart_baud_rate, params.uart_stop_bits == 2)) return false;
 	}
 	else if (params.connect_usb)
 	{
-		if (!odrive.connect_usb()) return false;
+		if (!odrive.connect_usb(params.usb_serial.c_str())) return false;
+	}
+	else if (params.connect_sim)
+	{
+		static ODriveSim sim;
+		sim.latency = params.sim_latency;
+		sim.packet_loss = params.sim_loss;
+		if (!odrive.connect_sim(&sim)) return false;
 	}
 	else
 		return false;
+	return true;
+}
+
+bool odrive_control_init(const Params& params)
+{
+	if (!odrive_control_connect(params))
+		return false;
+
+	resolve_endpoints();
+	enable_shadow_values();
+	add_polled_values();
+
+	stats_top = params.stats_top;
+	error_sweep_interval = params.error_sweep_interval;
+	odrive.collect_stats = stats_top > 0;
 
 	// Temporarilly disable watchdog, so it won't immediately make errors
 	for (int a = 0; a < monitor_axes; a++)
@@ -139,14 +306,15 @@ bool odrive_control_init(const Params& params)
 	odrive_control_get_control_data();
 	cd_counter = cd.odrive_set_control_counter;
 
+	bool all_axes[monitor_axes];
 	for (int a = 0; a < monitor_axes; a++)
 	{
 		odrive_control_axis_get_control_data(a);
-
-		// Retrieve initial sensor values so we fail early if odrive_control_update_axis fails for some reason.
 		cd_counter_axis[a] = cd.axes[a].odrive_set_control_counter;
-		odrive_control_update_axis(a);
+		all_axes[a] = true;
 	}
+	// Retrieve initial sensor values so we fail early if odrive_control_update_axes fails for some reason.
+	odrive_control_update_axes(all_axes);
 
 	// Enable watchdog
 	for (int a = 0; a < monitor_axes; a++)
@@ -159,11 +327,13 @@ bool odrive_control_init(const Params& params)
 
 	if (!check_errors_and_watchdog_feed())
 		return false;
-	return true;
+	last_link_stats = odrive.get_link_stats();
+	return poller.start(odrive, poller_frame_rate);
 }
 
 void odrive_control_close()
 {
+	poller.stop();
 	if (odrive.is_connected)
 	{
 		for (int a = 0; a < monitor_axes; a++)
@@ -176,8 +346,35 @@ void odrive_control_close()
 	odrive.close();
 }
 
+bool odrive_control_config_backup(const Params& params)
+{
+	if (!odrive_control_connect(params))
+		return false;
+	bool ok = true;
+	if (params.config_backup_file.size())
+		ok = save_config_backup(odrive, params.config_backup_file.c_str());
+	if (ok && params.config_restore_file.size())
+		ok = restore_config_backup(odrive, params.config_restore_file.c_str());
+	odrive.close();
+	return ok;
+}
+
+void odrive_control_list_usb()
+{
+	std::vector<ODriveUsbInfo> list = ODrive::enumerate_usb();
+	if (list.empty())
+		printf("No ODrive found via USB.\n");
+	for (const ODriveUsbInfo& info : list)
+	{
+		printf("serial: %-14s bus: %3d address: %3d interface: %d endpoints: 0x%02x 0x%02x\n",
+			info.serial.size() ? info.serial.c_str() : "(no access)", info.bus, info.address,
+			info.usb_interface, info.write_endpoint, info.read_endpoint);
+	}
+}
+
 void odrive_control_get_control_data()
 {
+	odrive.pipeline_begin();
 	odrive.root("config")("max_regen_current").get(cd.max_regen_current);
 	odrive.root("config")("brake_resistance").get(cd.brake_resistance);
 	odrive.root("config")("dc_max_positive_current").get(cd.dc_max_positive_current);
@@ -187,9 +384,11 @@ void odrive_control_get_control_data()
 	odrive.root("ibus_report_filter_k").get(cd.ibus_report_filter_k);
 	if (odrive.root.odrive_fw_is_milana())
 		odrive.root("generate_error_on_filtered_ibus").get(cd.generate_error_on_filtered_ibus);
+	odrive.pipeline_end();
 }
 void odrive_control_set_control_data()
 {
+	odrive.pipeline_begin();
 	odrive.root("config")("max_regen_current").set(cd.max_regen_current);
 	odrive.root("config")("brake_resistance").set(cd.brake_resistance);
 	odrive.root("config")("dc_max_positive_current").set(cd.dc_max_positive_current);
@@ -199,12 +398,14 @@ void odrive_control_set_control_data()
 	odrive.root("ibus_report_filter_k").set(cd.ibus_report_filter_k);
 	if (odrive.root.odrive_fw_is_milana())
 		odrive.root("generate_error_on_filtered_ibus").set(cd.generate_error_on_filtered_ibus);
+	odrive.pipeline_end();
 }
 
 void odrive_control_axis_get_control_data(int a)
 {
 	Endpoint& axis = get_axis(a);
 	ControlDataAxis& acd = cd.axes[a];
+	odrive.pipeline_begin();
 
 	// motor
 	Endpoint& motor_config = axis("motor")("config");
@@ -239,12 +440,14 @@ void odrive_control_axis_get_control_data(int a)
 	encoder_config("abs_spi_cs_gpio_pin").get(acd.encoder_abs_spi_cs_gpio_pin);
 	if (odrive.root.odrive_fw_is_milana())
 		encoder_config("ignore_abs_ams_error_flag").get(acd.encoder_ignore_abs_ams_error_flag);
+	odrive.pipeline_end();
 }
 
 void odrive_control_axis_set_control_data(int a)
 {
 	Endpoint& axis = get_axis(a);
 	ControlDataAxis& acd = cd.axes[a];
+	odrive.pipeline_begin();
 
 	// motor
 	Endpoint& motor_config = axis("motor")("config");
@@ -279,53 +482,106 @@ void odrive_control_axis_set_control_data(int a)
 	encoder_config("abs_spi_cs_gpio_pin").set(acd.encoder_abs_spi_cs_gpio_pin);
 	if (odrive.root.odrive_fw_is_milana())
 		encoder_config("ignore_abs_ams_error_flag").set(acd.encoder_ignore_abs_ams_error_flag);
+	odrive.pipeline_end();
 }
 
-void odrive_control_update_axis(int a)
+// The setpoints of all axes are written in one burst ahead of everything else, then the feedback
+// is read, all in one batch. For axes that move together, like two motors on one joint, the
+// time between their setpoints matters more than the frame time, so it is measured in
+// md.setpoint_skew.
+void odrive_control_update_axes(const bool* axes)
 {
-	Endpoint& axis = get_axis(a);
 	//axis("watchdog_feed").call(); // called by any_errors_and_watchdog_feed
-	if (cd_counter_axis[a] != cd.axes[a].odrive_set_control_counter)
+	for (int a = 0; a < monitor_axes; a++)
 	{
-		odrive_control_axis_set_control_data(a);
-		cd_counter_axis[a] = cd.axes[a].odrive_set_control_counter;
+		if (axes[a] && cd_counter_axis[a] != cd.axes[a].odrive_set_control_counter)
+		{
+			odrive_control_axis_set_control_data(a);
+			cd_counter_axis[a] = cd.axes[a].odrive_set_control_counter;
+		}
 	}
 
-	bool should_run = cd.axes[a].enable_motor;
-	if (should_run != md.axes[a].is_running)
+	odrive.pipeline_begin();
+	for (int a = 0; a < monitor_axes; a++)
 	{
-		axis("requested_state").set(should_run ? AXIS_STATE_CLOSED_LOOP_CONTROL : AXIS_STATE_IDLE);
+		const AxisEndpoints& e = axis_endpoints[a];
+		bool should_run = cd.axes[a].enable_motor;
+		if (!axes[a] || should_run == md.axes[a].is_running)
+			continue;
+		e.requested_state.set(should_run ? AXIS_STATE_CLOSED_LOOP_CONTROL : AXIS_STATE_IDLE);
 		md.axes[a].is_running = should_run;
+		// Entering closed loop control resets the setpoints on ODrive.
+		odrive.invalidate_shadow(e.input_pos);
+		odrive.invalidate_shadow(e.input_vel);
+		odrive.invalidate_shadow(e.input_torque);
 	}
 
-	// Set target value based on control mode
-	md.axes[a].input_torque = 0;
-	md.axes[a].input_vel = 0;
-	md.axes[a].input_pos = 0;
-	switch (cd.axes[a].control_mode)
+	// Set target value based on control mode. With the ASCII protocol the setpoint commands
+	// p, v and c are used, they aren't acknowledged.
+	WriteTiming timing;
+	EndpointHandle setpoints[monitor_axes];
+	float values[monitor_axes];
+	int num_setpoints = 0;
+	bool ascii = odrive.is_ascii();
+	for (int a = 0; a < monitor_axes; a++)
 	{
-	case CONTROL_MODE_TORQUE_CONTROL:
-		axis("controller")("input_torque").set(cd.axes[a].input_torque);
-		md.axes[a].input_torque = cd.axes[a].input_torque;
-		break;
-	case CONTROL_MODE_VELOCITY_CONTROL:
-		axis("controller")("input_vel").set(cd.axes[a].input_vel);
-		md.axes[a].input_vel = cd.axes[a].input_vel;
-		break;
-	case CONTROL_MODE_POSITION_CONTROL:
-		axis("controller")("input_pos").set(cd.axes[a].input_pos);
-		md.axes[a].input_pos = cd.axes[a].input_pos;
-		break;
+		if (!axes[a])
+			continue;
+		const AxisEndpoints& e = axis_endpoints[a];
+		md.axes[a].input_torque = 0;
+		md.axes[a].input_vel = 0;
+		md.axes[a].input_pos = 0;
+		char command;
+		EndpointHandle setpoint;
+		float value;
+		switch (cd.axes[a].control_mode)
+		{
+		case CONTROL_MODE_TORQUE_CONTROL:
+			command = 'c';
+			setpoint = e.input_torque;
+			value = md.axes[a].input_torque = cd.axes[a].input_torque;
+			break;
+		case CONTROL_MODE_VELOCITY_CONTROL:
+			command = 'v';
+			setpoint = e.input_vel;
+			value = md.axes[a].input_vel = cd.axes[a].input_vel;
+			break;
+		case CONTROL_MODE_POSITION_CONTROL:
+			command = 'p';
+			setpoint = e.input_pos;
+			value = md.axes[a].input_pos = cd.axes[a].input_pos;
+			break;
+		default:
+			continue;
+		}
+		if (ascii)
+			odrive.set_ascii_setpoint(command, a, value, &timing);
+		else
+		{
+			setpoints[num_setpoints] = setpoint;
+			values[num_setpoints] = value;
+			num_setpoints++;
+		}
 	}
+	if (!ascii)
+		odrive.set_synchronized(setpoints, values, num_setpoints, &timing);
 
+	float old_pos[monitor_axes];
+	for (int a = 0; a < monitor_axes; a++)
+	{
+		if (!axes[a])
+			continue;
+		old_pos[a] = md.axes[a].pos;
+		axis_endpoints[a].feedback.get(md.axes[a].pos, md.axes[a].vel, md.axes[a].current_target);
+	}
+	odrive.pipeline_end();
 
-	float old_pos = md.axes[a].pos;
-	axis("encoder")("pos_estimate").get(md.axes[a].pos);
-	md.axes[a].vel_coarse = (md.axes[a].pos-old_pos) / md.delta_time;
-
-	axis("encoder")("vel_estimate").get(md.axes[a].vel);
-
-	axis("motor")("current_control")("Iq_setpoint").get(md.axes[a].current_target);
+	md.setpoint_skew = timing.skew();
+	for (int a = 0; a < monitor_axes; a++)
+	{
+		if (axes[a])
+			md.axes[a].vel_coarse = (md.axes[a].pos-old_pos[a]) / md.delta_time;
+	}
 }
 
 static void odrive_control_handle_z_search(int a)
@@ -367,6 +623,7 @@ static void odrive_control_handle_calibration(int a)
 	if (cd.axes[a].calibration_trigger-last_calibration_trigger[a] == 1 && !md.axes[a].is_running)
 	{
 		axis("requested_state").set(AXIS_STATE_FULL_CALIBRATION_SEQUENCE);
+		odrive.invalidate_shadow(); // The calibration writes to the config
 		md.axes[a].encoder_ready = false;
 		md.axes[a].motor_is_calibrated = false;
 		md.axes[a].anticogging_valid = false;
@@ -435,37 +692,61 @@ static void odrive_control_handle_oscilloscope()
 		// We don't retrieve all values at once, because that would be very slow
 		// and MonitorData cannot handle a variable amount anyway.
 		md.oscilloscope_start = md.oscilloscope_end;
+#if 0
 		while (md.oscilloscope_end < oscilloscope_size &&
 			    md.oscilloscope_end-md.oscilloscope_start < oscilloscope_transmitting_size)
 		{
-#if 0
 			float value = -1;
 			odrive.root("get_oscilloscope_val").call(md.oscilloscope_end, &value);
 			md.oscilloscope_transmitting[md.oscilloscope_end-md.oscilloscope_start] = value;
 			md.oscilloscope_end++;
+		}
 #else
-			// speed up oscilloscope retrieval by sending 4 values, packed into 64bit, at once.
-			u64 value = 0;
-			odrive.root("get_oscilloscope_val_4").call(md.oscilloscope_end, &value);
-			int i = 0;
-			while (md.oscilloscope_end < oscilloscope_size &&
-					md.oscilloscope_end-md.oscilloscope_start < oscilloscope_transmitting_size &&
-					i < 4)
-			{
-				md.oscilloscope_transmitting[md.oscilloscope_end-md.oscilloscope_start] = half_to_float((u16)(value>>(i*16)));
-				md.oscilloscope_end++;
-				i++;
-			}
+		// speed up oscilloscope retrieval by sending 4 values, packed into 64bit, at once.
+		// All calls for this frame are queued in one pipeline. They are still answered one after
+		// the other (see ODrive.h), but without a flush in between.
+		u64 values[(oscilloscope_transmitting_size+3)/4] = {};
+		int num_values = std::min(oscilloscope_size-md.oscilloscope_end, oscilloscope_transmitting_size);
+		odrive.pipeline_begin();
+		for (int i = 0; i < num_values; i += 4)
+			odrive.root("get_oscilloscope_val_4").call(md.oscilloscope_end+i, &values[i/4]);
+		odrive.pipeline_end();
+		for (int i = 0; i < num_values; i++)
+			md.oscilloscope_transmitting[i] = half_to_float((u16)(values[i/4]>>((i%4)*16)));
+		md.oscilloscope_end += num_values;
 #endif
-		}
 		if (md.oscilloscope_start == md.oscilloscope_end)
 			md.oscilloscope_state = 0;
 	}
 }
 
+// Prints the slowest endpoints every 10 seconds. If this frame took much longer than usual,
+// the endpoints that were slow in this frame are printed too.
+static void print_endpoint_stats(u64_micros frame_start_time)
+{
+	static float average_delta_time = 0;
+	static u64_micros last_print_time = 0;
+	u64_micros now = time_micros_64();
+	if (!last_print_time)
+		last_print_time = now;
+	if (average_delta_time && md.delta_time_odrive > 4*average_delta_time && md.delta_time_odrive > 2000)
+	{
+		printf("slow frame: %uus (average %.0fus)\n", md.delta_time_odrive, average_delta_time);
+		odrive.print_slowest_endpoints(stats_top, frame_start_time);
+	}
+	average_delta_time = average_delta_time ? average_delta_time*0.99f + md.delta_time_odrive*0.01f : (float)md.delta_time_odrive;
+
+	if (now - last_print_time > 10000000)
+	{
+		odrive.print_slowest_endpoints(stats_top);
+		last_print_time = now;
+	}
+}
+
 bool odrive_control_update()
 {
 	u32_micros start_time = time_micros();
+	u64_micros frame_start_time = time_micros_64();
 	
 	// Setting all the ODrive values is quite slow, so we do it only when control_ui actually changes something.
 	// control_ui indicates this by changing cd.odrive_set_control_counter
@@ -490,26 +771,25 @@ bool odrive_control_update()
 
 	odrive_control_handle_oscilloscope();
 
+	poller.get(polled.vbus_voltage, md.odrive_bus_voltage);
+	poller.get(polled.ibus, md.odrive_bus_current);
+
+	bool update_axes[monitor_axes];
 	for (int a = 0; a < monitor_axes; a++)
 	{
 		Endpoint& axis = get_axis(a);
+		update_axes[a] = cd.axes[a].enable_axis;
 		if (cd.axes[a].enable_axis)
 		{
 			odrive_control_handle_z_search(a);
 			odrive_control_handle_calibration(a);
-			odrive_control_update_axis(a);
 
-			// We want these variables for debugging purposes, but don't want to waste too much time
-			// retrieving them. So we retrieve only one variable per timestep.
-			switch (md.counter%6)
-			{
-			case 0: odrive.root("vbus_voltage").get(md.odrive_bus_voltage); break;
-			case 1: odrive.root("ibus").get(md.odrive_bus_current); break;
-			case 2: if (odrive.root.odrive_fw_is_milana()) axis("encoder")("index_check_cumulative_error").get(md.axes[a].encoder_index_error); break;
-			case 3: if (odrive.root.odrive_fw_is_milana()) axis("encoder")("index_check_index_count").get(md.axes[a].encoder_index_count); break;
-			case 4: axis("encoder")("shadow_count").get(md.axes[a].encoder_shadow_count); break;
-			case 5: axis("controller")("anticogging_valid").get(md.axes[a].anticogging_valid); break;
-			}
+			// Values that aren't found (not Milana firmware) or that weren't read yet are left as they are.
+			const PolledValues::Axis& p = polled.axes[a];
+			poller.get(p.index_check_cumulative_error, md.axes[a].encoder_index_error);
+			poller.get(p.index_check_index_count, md.axes[a].encoder_index_count);
+			poller.get(p.shadow_count, md.axes[a].encoder_shadow_count);
+			poller.get(p.anticogging_valid, md.axes[a].anticogging_valid);
 		}
 		else
 		{
@@ -525,6 +805,8 @@ bool odrive_control_update()
 			md.axes[a].current_target = 0;
 		}
 	}
+	odrive_control_update_axes(update_axes);
+
 	if (!check_errors_and_watchdog_feed())
 		return false;
 	
@@ -541,11 +823,25 @@ bool odrive_control_update()
 	{
 		printf("reboot()\n");
 		odrive.root("reboot").call();
+		odrive.invalidate_shadow();
 	}
 	last_odrive_reboot = cd.odrive_reboot_trigger;
 
 	
 	md.delta_time_odrive = time_micros() - start_time;
 
+	// This includes the requests of the poller.
+	LinkStats link_stats = odrive.get_link_stats();
+	LinkStats frame_link_stats = link_stats - last_link_stats;
+	last_link_stats = link_stats;
+	md.link_crc_errors = frame_link_stats.crc_errors;
+	md.link_resyncs = frame_link_stats.resyncs;
+	md.link_unexpected_responses = frame_link_stats.unexpected_responses;
+	md.link_timeouts = frame_link_stats.timeouts;
+	md.link_resends = frame_link_stats.resends;
+
+	if (stats_top)
+		print_endpoint_stats(frame_start_time);
+
 	return true;
 }
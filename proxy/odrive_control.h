@@ -2,6 +2,9 @@
 struct Params;
 bool odrive_control_init(const Params& params);
 void odrive_control_close();
+// Connects, saves and/or restores the config as given in params and disconnects again.
+bool odrive_control_config_backup(const Params& params);
+void odrive_control_list_usb();
 bool odrive_control_update();
 
 
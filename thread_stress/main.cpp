@@ -0,0 +1,288 @@
+// Uses one simulated ODrive (see odrive_sim.h) from several threads at the same time and checks
+// that every response ends up with the thread that sent the request. Each thread owns some
+// writable values, writes numbers to them that no other thread uses and reads them back, in
+// pipelines and with single requests. A response that lands in the wrong thread shows up as a
+// value that doesn't match. There are:
+// - a control thread that reads and writes a few values every frame, like the proxy,
+// - writer threads that each own a gain of both axes,
+// - a background thread (ODrive::set_background_thread()) with big batches, like ODrivePoller,
+// - an oscilloscope thread that calls one function several times per pipeline, like the proxy.
+//   The simulated get_oscilloscope_val returns its index.
+// With --loss, requests and responses get lost and have to be sent again, which must not change
+// the order of a write and the read after it. At the end the longest frame of the control
+// thread is printed. Returns 1 if a check failed.
+#include <stdlib.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <algorithm>
+#include <stdexcept>
+#include "../common/odrive/ODrive.h"
+#include "../common/odrive/odrive_sim.h"
+#include "../common/time_helper.h"
+
+struct Params
+{
+	int iterations = 300; // of each writer thread
+	u32 latency = 200;
+	float loss = 0;
+	u32 seed = 1;
+};
+
+static void print_usage(char** argv, const Params& params)
+{
+	printf("Checks that the responses of a simulated ODrive reach the right thread when several threads use it.\n");
+	printf("\n");
+	printf("usage: %s [options]\n", argv[0]);
+	printf("\n");
+	printf("options:\n");
+	printf("  -h, --help            show this help message and exit\n");
+	printf("  -n N, --iterations N  write/read cycles of each writer thread (default: %d)\n", params.iterations);
+	printf("  --latency US          time until the simulated ODrive answers in microseconds (default: %u)\n", params.latency);
+	printf("  --loss P              probability that a request or response is lost (default: %g)\n", params.loss);
+	printf("  --seed N              seed for the random loss (default: %u)\n", params.seed);
+	printf("\n");
+}
+
+static bool params_parse_ex(int argc, char** argv, Params& params)
+{
+	bool invalid_param = false;
+	std::string arg;
+	for (int i = 1; i < argc; i++)
+	{
+		arg = argv[i];
+		if (arg == "-h" || arg == "--help")
+		{
+			return false;
+		}
+		else if (arg == "-n" || arg == "--iterations")
+		{
+			if (++i >= argc)
+			{
+				invalid_param = true;
+				break;
+			}
+			params.iterations = std::stoi(argv[i]);
+			if (params.iterations <= 0)
+			{
+				invalid_param = true;
+				break;
+			}
+		}
+		else if (arg == "--latency")
+		{
+			if (++i >= argc)
+			{
+				invalid_param = true;
+				break;
+			}
+			params.latency = (u32)std::stoul(argv[i]);
+		}
+		else if (arg == "--loss")
+		{
+			if (++i >= argc)
+			{
+				invalid_param = true;
+				break;
+			}
+			params.loss = std::stof(argv[i]);
+			if (params.loss < 0 || params.loss >= 1)
+			{
+				invalid_param = true;
+				break;
+			}
+		}
+		else if (arg == "--seed")
+		{
+			if (++i >= argc)
+			{
+				invalid_param = true;
+				break;
+			}
+			params.seed = (u32)std::stoul(argv[i]);
+		}
+		else
+		{
+			invalid_param = true;
+			break;
+		}
+	}
+	if (invalid_param)
+		throw std::invalid_argument("error: invalid parameter \"" + arg + "\"");
+	return true;
+}
+
+static void params_parse(int argc, char** argv, Params& params)
+{
+	try
+	{
+		if (!params_parse_ex(argc, argv, params))
+		{
+			print_usage(argv, Params());
+			exit(0);
+		}
+	}
+	catch (const std::exception& ex)
+	{
+		fprintf(stderr, "%s\n", ex.what());
+		print_usage(argv, Params());
+		exit(1);
+	}
+}
+
+static std::atomic<int> failures{0};
+
+static void check(const char* thread, const char* what, float expected, float received)
+{
+	if (received == expected)
+		return;
+	failures++;
+	printf("%s: %s should be %g, but is %g\n", thread, what, expected, received);
+}
+
+static void collect_values(const Endpoint& endpoint, std::vector<EndpointHandle>& handles)
+{
+	for (int i = 0; i < endpoint.num_children; i++)
+	{
+		const Endpoint& child = endpoint.children[i];
+		if (child.has_children())
+			collect_values(child, handles);
+		else if (child.type_enum != EndpointType::function && child.type_enum != EndpointType::invalid)
+			handles.push_back(child.handle());
+	}
+}
+
+int main(int argc, char** argv)
+{
+	Params params;
+	params_parse(argc, argv, params);
+	time_init();
+
+	ODriveSim sim;
+	sim.latency = params.latency;
+	sim.packet_loss = params.loss;
+	sim.set_seed(params.seed);
+
+	ODrive odrive;
+	// Lost packets and the waiting for the other threads can take a while, that's no error here.
+	odrive.request_timeout = 10000000;
+	if (!odrive.connect_sim(&sim))
+	{
+		printf("cannot connect to the simulated ODrive\n");
+		return EXIT_FAILURE;
+	}
+
+	std::atomic<bool> writers_done{false};
+	std::vector<std::thread> threads;
+
+	int control_frames = 0;
+	u32_micros max_frame_time = 0;
+	threads.emplace_back([&]
+	{
+		EndpointHandle filter_k = odrive.root("ibus_report_filter_k").handle();
+		EndpointHandle fw_version_minor = odrive.root("fw_version_minor").handle();
+		EndpointHandle pos_estimate = odrive.root("axis0")("encoder")("pos_estimate").handle();
+		while (!writers_done && !odrive.communication_error)
+		{
+			float value = (float)control_frames, received = -1, pos;
+			u8 version = 0;
+			u32_micros start_time = time_micros();
+			odrive.pipeline_begin();
+			filter_k.set(value);
+			pos_estimate.get(pos);
+			filter_k.get(received);
+			fw_version_minor.get(version);
+			odrive.pipeline_end();
+			max_frame_time = std::max(max_frame_time, time_micros() - start_time);
+			check("control", "ibus_report_filter_k", value, received);
+			check("control", "fw_version_minor", 5, version);
+			control_frames++;
+			imprecise_sleep(.001);
+		}
+		odrive.end_thread();
+	});
+
+	const char* gains[] = {"pos_gain", "vel_gain", "vel_integrator_gain", "vel_limit"};
+	std::vector<std::thread> writers;
+	for (int k = 0; k < 4; k++)
+	{
+		writers.emplace_back([&, k]
+		{
+			EndpointHandle gain0 = odrive.root("axis0")("controller")("config")(gains[k]).handle();
+			EndpointHandle gain1 = odrive.root("axis1")("controller")("config")(gains[k]).handle();
+			for (int i = 0; i < params.iterations && !odrive.communication_error; i++)
+			{
+				float value = k*1000.0f + i, received0 = -1, received1 = -1, single = -1;
+				odrive.pipeline_begin();
+				gain0.set(value);
+				gain1.set(value + .5f);
+				gain0.get(received0);
+				gain1.get(received1);
+				odrive.pipeline_end();
+				gain0.get(single);
+				check(gains[k], "axis0", value, received0);
+				check(gains[k], "axis1", value + .5f, received1);
+				check(gains[k], "single read", value, single);
+			}
+			odrive.end_thread();
+		});
+	}
+
+	int background_batches = 0;
+	threads.emplace_back([&]
+	{
+		odrive.set_background_thread();
+		std::vector<EndpointHandle> all;
+		collect_values(odrive.root, all);
+		std::vector<s64> values(all.size());
+		EndpointHandle brake_resistance = odrive.root("config")("brake_resistance").handle();
+		while (!writers_done && !odrive.communication_error)
+		{
+			float value = (float)background_batches, received = -1;
+			odrive.pipeline_begin();
+			brake_resistance.set(value);
+			for (size_t i = 0; i < all.size(); i++)
+				all[i].get_any(values[i]);
+			brake_resistance.get(received);
+			odrive.pipeline_end();
+			check("background", "brake_resistance", value, received);
+			background_batches++;
+		}
+		odrive.end_thread();
+	});
+
+	int oscilloscope_batches = 0;
+	threads.emplace_back([&]
+	{
+		const Endpoint& get_oscilloscope_val = odrive.root("get_oscilloscope_val");
+		const int calls = 4;
+		while (!writers_done && !odrive.communication_error)
+		{
+			float values[calls];
+			odrive.pipeline_begin();
+			for (int i = 0; i < calls; i++)
+				get_oscilloscope_val.call((u32)(oscilloscope_batches*calls + i), &values[i]);
+			odrive.pipeline_end();
+			for (int i = 0; i < calls; i++)
+				check("oscilloscope", "get_oscilloscope_val", (float)(oscilloscope_batches*calls + i), values[i]);
+			oscilloscope_batches++;
+		}
+		odrive.end_thread();
+	});
+
+	for (std::thread& t : writers)
+		t.join();
+	writers_done = true;
+	for (std::thread& t : threads)
+		t.join();
+
+	printf("%d control frames (longest %.2f ms), %d background batches, %d oscilloscope batches, %d requests, %d packets lost\n",
+		control_frames, max_frame_time * .001, background_batches, oscilloscope_batches, sim.requests_handled, sim.packets_dropped);
+	if (odrive.communication_error)
+		printf("communication error\n");
+	if (failures)
+		printf("%d responses were wrong\n", (int)failures);
+	return failures || odrive.communication_error ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,379 @@
+// Emulates an ODrive that is connected via UART, so the UART code in ODrive.cpp can be tested
+// without hardware. It opens a pseudo terminal and prints the path of its slave device, which
+// can be passed to the proxy with --uart. The requests are answered by ODriveSim (see
+// odrive_sim.h) and both directions are throttled to the configured baud rate, so the timing
+// is close to a real UART. Once per second the number of handled requests is printed.
+// With --ascii it speaks the ASCII protocol instead (proxy --uart-ascii).
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+#include <termios.h>
+#include <sys/select.h>
+#include <string>
+#include <stdexcept>
+#include <algorithm>
+#include "../common/odrive/ODrive.h"
+#include "../common/odrive/odrive_sim.h"
+#include "../common/time_helper.h"
+
+struct Params
+{
+    int baud_rate = 921600;
+    int stop_bits = 1;
+    u32 latency = 100; // microseconds, processing time of the firmware
+    float loss = 0;
+    float corruption = 0;
+    u32 seed = 1;
+    bool ascii = false;
+};
+
+static bool running = true;
+
+static void ctrl_c_handler(int signum)
+{
+	running = false;
+}
+
+static void print_usage(char** argv, const Params& params)
+{
+    printf("Emulates an ODrive connected via UART on a pseudo terminal. Connect to it with: proxy --uart <printed path>\n");
+    printf("\n");
+    printf("usage: %s [options]\n", argv[0]);
+    printf("\n");
+    printf("options:\n");
+    printf("  -h, --help            show this help message and exit\n");
+    printf("  -b N, --baudrate N    baud rate the bytes are throttled to (default: %d)\n", params.baud_rate);
+    printf("  -s N, --stop-bits N   number of stop bits (1 or 2) (default: %d)\n", params.stop_bits);
+    printf("  --latency US          time until ODrive starts to answer in microseconds (default: %u)\n", params.latency);
+    printf("  --loss P              probability that a request or response is lost (default: %g)\n", params.loss);
+    printf("  --corrupt P           probability that a sent byte is changed (default: %g)\n", params.corruption);
+    printf("  --seed N              seed for the random loss and corruption (default: %u)\n", params.seed);
+    printf("  --ascii               use the ASCII protocol instead of fibre\n");
+    printf("\n");
+}
+
+static bool params_parse_ex(int argc, char** argv, Params& params)
+{
+    bool invalid_param = false;
+    std::string arg;
+    for (int i = 1; i < argc; i++)
+    {
+        arg = argv[i];
+        if (arg == "-h" || arg == "--help")
+        {
+            return false;
+        }
+        else if (arg == "-b" || arg == "--baudrate")
+        {
+            if (++i >= argc)
+            {
+                invalid_param = true;
+                break;
+            }
+            params.baud_rate = std::stoi(argv[i]);
+            if (params.baud_rate <= 0)
+            {
+                invalid_param = true;
+                break;
+            }
+        }
+        else if (arg == "-s" || arg == "--stop-bits")
+        {
+            if (++i >= argc)
+            {
+                invalid_param = true;
+                break;
+            }
+            params.stop_bits = std::stoi(argv[i]);
+            if (params.stop_bits != 1 && params.stop_bits != 2)
+            {
+                invalid_param = true;
+                break;
+            }
+        }
+        else if (arg == "--latency")
+        {
+            if (++i >= argc)
+            {
+                invalid_param = true;
+                break;
+            }
+            params.latency = (u32)std::stoul(argv[i]);
+        }
+        else if (arg == "--loss")
+        {
+            if (++i >= argc)
+            {
+                invalid_param = true;
+                break;
+            }
+            params.loss = std::stof(argv[i]);
+            if (params.loss < 0 || params.loss >= 1)
+            {
+                invalid_param = true;
+                break;
+            }
+        }
+        else if (arg == "--corrupt")
+        {
+            if (++i >= argc)
+            {
+                invalid_param = true;
+                break;
+            }
+            params.corruption = std::stof(argv[i]);
+            if (params.corruption < 0 || params.corruption >= 1)
+            {
+                invalid_param = true;
+                break;
+            }
+        }
+        else if (arg == "--seed")
+        {
+            if (++i >= argc)
+            {
+                invalid_param = true;
+                break;
+            }
+            params.seed = (u32)std::stoul(argv[i]);
+        }
+        else if (arg == "--ascii")
+        {
+            params.ascii = true;
+        }
+        else
+        {
+            throw std::invalid_argument("error: unknown argument: " + arg);
+        }
+    }
+    if (invalid_param)
+    {
+        throw std::invalid_argument("error: invalid parameter for argument: " + arg);
+    }
+    return true;
+}
+
+static void params_parse(int argc, char** argv, Params& params)
+{
+    try
+    {
+        if (!params_parse_ex(argc, argv, params))
+        {
+            print_usage(argv, Params());
+            exit(0);
+        }
+    }
+    catch (const std::exception& ex)
+    {
+        fprintf(stderr, "%s\n", ex.what());
+        print_usage(argv, Params());
+        exit(1);
+    }
+}
+
+// Opens the master side of a pseudo terminal. The slave side is kept open as well, otherwise
+// reading from the master fails with EIO every time the proxy disconnects.
+static bool open_pty(int* master, int* slave, std::string* slave_path)
+{
+	*master = posix_openpt(O_RDWR | O_NOCTTY);
+	if (*master < 0 || grantpt(*master) != 0 || unlockpt(*master) != 0)
+	{
+		printf("Failed to create a pseudo terminal: %s\n", strerror(errno));
+		return false;
+	}
+	*slave_path = ptsname(*master);
+	*slave = open(slave_path->c_str(), O_RDWR | O_NOCTTY);
+	if (*slave < 0)
+	{
+		printf("Failed to open %s: %s\n", slave_path->c_str(), strerror(errno));
+		return false;
+	}
+	// No echo or line editing until the proxy configures the terminal itself.
+	termios options;
+	tcgetattr(*slave, &options);
+	cfmakeraw(&options);
+	tcsetattr(*slave, TCSANOW, &options);
+	fcntl(*master, F_SETFL, fcntl(*master, F_GETFL) | O_NONBLOCK);
+	return true;
+}
+
+int main(int argc, char** argv)
+{
+	Params params;
+	params_parse(argc, argv, params);
+
+	struct sigaction sa = {};
+	sa.sa_handler = ctrl_c_handler;
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+
+	time_init();
+
+	int master, slave;
+	std::string slave_path;
+	if (!open_pty(&master, &slave, &slave_path))
+		return EXIT_FAILURE;
+
+	ODriveSim sim;
+	sim.latency = params.latency;
+	sim.packet_loss = params.loss;
+	sim.set_seed(params.seed);
+	srand(params.seed);
+
+	// Start bit, 8 data bits and the stop bits.
+	double byte_time = (9.0+params.stop_bits) * 1000000.0 / params.baud_rate;
+	printf("Emulating ODrive on %s at %d baud (%.1fus per byte)\n", slave_path.c_str(), params.baud_rate, byte_time);
+	fflush(stdout);
+
+	// Received bytes are only handed to the parser once they could have been transmitted. The
+	// same goes for sending: tx_time is when the next byte starts to be transmitted.
+	u8 rx_stream[4*max_stream_packet_size];
+	int rx_length = 0;
+	double rx_time = 0;
+	u8 tx_stream[64*max_stream_packet_size];
+	int tx_length = 0, tx_sent = 0;
+	double tx_time = 0;
+
+	int resyncs = 0;
+	int last_requests = 0;
+	u64_micros last_report = time_micros_64();
+	while (running)
+	{
+		u64_micros now = time_micros_64();
+
+		// Wait for the next byte from the proxy, but not longer than until a received request is
+		// complete, the next byte can be sent or the next response is due.
+		u64_micros wake_time = now + 10000;
+		if (rx_time > now)
+			wake_time = std::min(wake_time, now + (u64_micros)byte_time + 1);
+		if (tx_sent < tx_length)
+			wake_time = std::min(wake_time, (u64_micros)(tx_time+byte_time));
+		if (sim.next_response_time())
+			wake_time = std::min(wake_time, sim.next_response_time());
+		if (wake_time > now)
+		{
+			fd_set read_set;
+			FD_ZERO(&read_set);
+			FD_SET(master, &read_set);
+			u64_micros timeout = wake_time-now;
+			timeval tv = {(time_t)(timeout/1000000), (suseconds_t)(timeout%1000000)};
+			select(master+1, &read_set, nullptr, nullptr, &tv);
+			now = time_micros_64();
+		}
+
+		// If the buffer is full, the rest stays in the pseudo terminal until the parser catches up.
+		int space = (int)sizeof(rx_stream)-rx_length;
+		int n = space > 0 ? (int)read(master, rx_stream+rx_length, space) : 0;
+		if (n > 0)
+		{
+			rx_time = std::max(rx_time, (double)now) + n*byte_time;
+			rx_length += n;
+		}
+
+		// Only the bytes that have arrived by now are parsed. A request is handled once its last
+		// byte is there.
+		int pending = rx_time > now ? std::min((int)((rx_time-now) / byte_time) + 1, rx_length) : 0;
+		int arrived = rx_length - pending;
+		if (arrived > 0 && params.ascii)
+		{
+			u8* newline;
+			while ((newline = (u8*)memchr(rx_stream, '\n', arrived)) != nullptr)
+			{
+				int consumed = (int)(newline-rx_stream)+1;
+				*newline = 0;
+				sim.handle_ascii_line((const char*)rx_stream, now);
+				memmove(rx_stream, rx_stream+consumed, rx_length-consumed);
+				rx_length -= consumed;
+				arrived -= consumed;
+			}
+			if (rx_length == (int)sizeof(rx_stream) && !memchr(rx_stream, '\n', rx_length))
+			{
+				// A line that doesn't fit is garbage.
+				resyncs++;
+				rx_length = 0;
+			}
+		}
+		else if (arrived > 0)
+		{
+			u8 packet[max_packet_size];
+			int packet_length, consumed;
+			bool skipped;
+			for (;;)
+			{
+				bool found = ODrive::find_stream_packet(rx_stream, arrived, packet, max_packet_size, &packet_length, &consumed, &skipped);
+				if (skipped)
+					resyncs++;
+				memmove(rx_stream, rx_stream+consumed, rx_length-consumed);
+				rx_length -= consumed;
+				arrived -= consumed;
+				if (!found)
+					break;
+				sim.handle_packet(packet, packet_length, now);
+			}
+		}
+
+		u8 response[max_packet_size];
+		int response_length;
+		while (tx_length+max_stream_packet_size <= (int)sizeof(tx_stream) &&
+			sim.receive_response(response, max_packet_size, &response_length, now))
+		{
+			stream_buffer stream;
+			if (params.ascii)
+			{
+				// ASCII responses are complete lines already.
+				for (int i = 0; i < response_length; i++)
+					stream.push_back(response[i]);
+			}
+			else
+			{
+				serial_buffer packet;
+				for (int i = 0; i < response_length; i++)
+					packet.push_back(response[i]);
+				stream = ODrive::packet_to_stream(packet);
+			}
+			for (u8 b : stream)
+			{
+				if (params.corruption > 0 && (double)rand() < params.corruption*(double)RAND_MAX)
+					b ^= (u8)(1 << (rand()%8));
+				tx_stream[tx_length++] = b;
+			}
+			tx_time = std::max(tx_time, (double)now);
+		}
+
+		// Write the bytes that would have been transmitted completely by now.
+		if (tx_sent < tx_length)
+		{
+			int count = std::min((int)(((double)now-tx_time) / byte_time), tx_length-tx_sent);
+			int written = count > 0 ? (int)write(master, tx_stream+tx_sent, count) : 0;
+			if (written > 0)
+			{
+				tx_sent += written;
+				tx_time += written*byte_time;
+			}
+		}
+		if (tx_sent == tx_length)
+			tx_length = tx_sent = 0;
+		else if (tx_sent > (int)sizeof(tx_stream)/2)
+		{
+			memmove(tx_stream, tx_stream+tx_sent, tx_length-tx_sent);
+			tx_length -= tx_sent;
+			tx_sent = 0;
+		}
+
+		if (now-last_report >= 1000000)
+		{
+			printf("requests/s: %d  lost: %d  resyncs: %d\n", sim.requests_handled-last_requests, sim.packets_dropped, resyncs);
+			fflush(stdout);
+			last_requests = sim.requests_handled;
+			last_report = now;
+		}
+	}
+
+	close(slave);
+	close(master);
+	return EXIT_SUCCESS;
+}